@@ -6,7 +6,7 @@ VERSION         ?= $(shell git --git-dir=src/.git log -1 --format='%cd.%h' --dat
 BROWSER         ?= chromium
 
 SUPPORT_MODULES := libpcre
-COMMON_MODULES  := xkbcommon
+COMMON_MODULES  := xkbcommon zlib
 GFX_MODULES     := pangocairo pango cairo
 XCB_MODULES     := cairo-xcb xcb-keysyms xcb-icccm xcb-ewmh xcb-util
 
@@ -282,12 +282,14 @@ $(eval $(call EXE,TEST,terminol/support/test-destroyer,test_destroyer.cxx,$(SUPP
 # COMMON
 #
 
-$(eval $(call LIB,terminol/common,ascii.cxx bindings.cxx bit_sets.cxx buffer.cxx config.cxx data_types.cxx escape.cxx simple_deduper.cxx enums.cxx key_map.cxx parser.cxx terminal.cxx tty.cxx utf8.cxx vt_state_machine.cxx,$(COMMON_CFLAGS),terminol/support))
+$(eval $(call LIB,terminol/common,ascii.cxx bindings.cxx bit_sets.cxx buffer.cxx config.cxx data_types.cxx escape.cxx exporter.cxx simple_deduper.cxx enums.cxx governor.cxx ingester.cxx key_map.cxx parser.cxx prefetcher.cxx searcher.cxx selected_text.cxx snapshot.cxx spill_file.cxx terminal.cxx trigram_index.cxx tty.cxx utf8.cxx vt_state_machine.cxx,$(COMMON_CFLAGS),terminol/support))
 
 $(eval $(call EXE,TEST,terminol/common/test-utf8,test_utf8.cxx,$(COMMON_CFLAGS),terminol/common,$(COMMON_LDFLAGS)))
 
 $(eval $(call EXE,TEST,terminol/common/test-data-types,test_data_types.cxx,$(COMMON_CFLAGS),terminol/common,$(COMMON_LDFLAGS)))
 
+$(eval $(call EXE,TEST,terminol/common/test-trigram-index,test_trigram_index.cxx,$(COMMON_CFLAGS),terminol/common,$(COMMON_LDFLAGS)))
+
 $(eval $(call EXE,PRIV,terminol/common/abuse,abuse.cxx,$(COMMON_CFLAGS),terminol/common,$(COMMON_LDFLAGS)))
 
 $(eval $(call EXE,PRIV,terminol/common/wedge,wedge.cxx,$(COMMON_CFLAGS),terminol/common,$(COMMON_LDFLAGS)))
@@ -306,6 +308,8 @@ $(eval $(call EXE,PRIV,terminol/common/play,play.cxx,$(COMMON_CFLAGS),terminol/c
 
 $(eval $(call EXE,PRIV,terminol/common/spinner,spinner.cxx,$(COMMON_CFLAGS),terminol/common,$(COMMON_LDFLAGS)))
 
+$(eval $(call EXE,PRIV,terminol/common/bench-dispatch,bench_dispatch.cxx,$(COMMON_CFLAGS),terminol/common,$(COMMON_LDFLAGS)))
+
 #
 # XCB
 #
@@ -0,0 +1,128 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/buffer.hxx"
+#include "terminol/common/simple_deduper.hxx"
+#include "terminol/support/sync_destroyer.hxx"
+#include "terminol/support/conv.hxx"
+#include "terminol/support/debug.hxx"
+
+#include <chrono>
+#include <iomanip>
+
+// Measure full-screen Buffer::dispatch() with a renderer that draws nothing.
+
+namespace {
+
+class NullRenderer : public Buffer::I_Renderer {
+    size_t _calls;
+
+public:
+    NullRenderer() : _calls(0) {}
+    virtual ~NullRenderer() {}
+
+    size_t getCalls() const { return _calls; }
+
+    void bufferDrawBg(Pos UNUSED(pos), int16_t UNUSED(count), UColor UNUSED(color)) override {
+        ++_calls;
+    }
+
+    void bufferDrawFg(Pos             UNUSED(pos),
+                      int16_t         UNUSED(count),
+                      UColor          UNUSED(color),
+                      AttrSet         UNUSED(attrs),
+                      const uint8_t * UNUSED(str),
+                      size_t          UNUSED(size)) override {
+        ++_calls;
+    }
+
+    void bufferDrawCursor(Pos             UNUSED(pos),
+                          UColor          UNUSED(fg),
+                          UColor          UNUSED(bg),
+                          AttrSet         UNUSED(attrs),
+                          const uint8_t * UNUSED(str),
+                          size_t          UNUSED(size),
+                          bool            UNUSED(wrapNext)) override {
+        ++_calls;
+    }
+
+    bool bufferMoveRows(int16_t UNUSED(begin),
+                        int16_t UNUSED(end),
+                        int16_t UNUSED(rows)) override {
+        return true;
+    }
+};
+
+const CharSub CS_US;
+
+void fill(Buffer & buffer, int16_t rows, int16_t cols, int32_t lines) {
+    for (int32_t i = 0; i != lines; ++i) {
+        for (int16_t j = 0; j != cols; ++j) {
+            if (j % 17 == 0) {
+                buffer.setFg(UColor::indexed(static_cast<uint8_t>((i + j) % 8)));
+            }
+            buffer.write(utf8::Seq(static_cast<uint8_t>('!' + (i * 7 + j) % 90)), true, false);
+        }
+        buffer.forwardIndex(true);
+    }
+
+    buffer.moveCursor(Pos(rows - 1, 0));
+}
+
+void bench(const char * name, Buffer & buffer, bool reverse, size_t iterations) {
+    NullRenderer renderer;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i != iterations; ++i) {
+        buffer.resetSnapshot();
+        buffer.damageViewport(false);
+        buffer.dispatch(reverse, renderer);
+    }
+
+    auto finish = std::chrono::steady_clock::now();
+    auto ns     = std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+
+    std::cout << std::left  << std::setw(12) << name << std::right
+              << std::setw(10) << ns / 1000 / static_cast<int64_t>(iterations) << " us/frame"
+              << std::setw(10) << renderer.getCalls() / iterations << " calls/frame"
+              << std::endl;
+}
+
+} // namespace {anonymous}
+
+int main(int argc, char * argv[]) {
+    int16_t rows       = 50;
+    int16_t cols       = 160;
+    size_t  iterations = 1000;
+
+    try {
+        if (argc > 1) { rows       = unstringify<int16_t>(argv[1]); }
+        if (argc > 2) { cols       = unstringify<int16_t>(argv[2]); }
+        if (argc > 3) { iterations = unstringify<size_t>(argv[3]); }
+    }
+    catch (const ParseError & error) {
+        FATAL("Usage: " << argv[0] << " [ROWS [COLS [ITERATIONS]]]: " << error.message);
+    }
+
+    Config        config;
+    SimpleDeduper deduper;
+    SyncDestroyer destroyer;
+    Buffer        buffer(config, deduper, destroyer, rows, cols, 1000,
+                         CharSubArray(&CS_US, &CS_US, &CS_US, &CS_US));
+
+    fill(buffer, rows, cols, 4 * rows);
+
+    bench("plain", buffer, false, iterations);
+    bench("reverse", buffer, true, iterations);
+
+    buffer.markSelection(Pos(rows / 4, cols / 3));
+    buffer.delimitSelection(Pos(3 * rows / 4, 2 * cols / 3), true);
+    bench("selection", buffer, false, iterations);
+    buffer.clearSelection();
+
+    buffer.scrollUpHistory(rows / 2);
+    bench("history", buffer, false, iterations);
+
+    return 0;
+}
@@ -48,10 +48,20 @@ std::ostream & operator << (std::ostream & ost, Action action) {
             return ost << "SCROLL_TOP";
         case Action::SCROLL_BOTTOM:
             return ost << "SCROLL_BOTTOM";
+        case Action::SCROLL_PREV_PROMPT:
+            return ost << "SCROLL_PREV_PROMPT";
+        case Action::SCROLL_NEXT_PROMPT:
+            return ost << "SCROLL_NEXT_PROMPT";
         case Action::CLEAR_HISTORY:
             return ost << "CLEAR_HISTORY";
+        case Action::SAVE_HISTORY:
+            return ost << "SAVE_HISTORY";
         case Action::SEARCH:
             return ost << "SEARCH";
+        case Action::SEARCH_NEXT:
+            return ost << "SEARCH_NEXT";
+        case Action::SEARCH_PREV:
+            return ost << "SEARCH_PREV";
         case Action::DEBUG_GLOBAL_TAGS:
             return ost << "DEBUG_GLOBAL_TAGS";
         case Action::DEBUG_LOCAL_TAGS:
@@ -56,8 +56,13 @@ enum class Action {
     SCROLL_DOWN_PAGE,
     SCROLL_TOP,
     SCROLL_BOTTOM,
+    SCROLL_PREV_PROMPT,
+    SCROLL_NEXT_PROMPT,
     CLEAR_HISTORY,
+    SAVE_HISTORY,
     SEARCH,
+    SEARCH_NEXT,
+    SEARCH_PREV,
     DEBUG_GLOBAL_TAGS,
     DEBUG_LOCAL_TAGS,
     DEBUG_HISTORY,
@@ -3,57 +3,71 @@
 
 #include "terminol/common/buffer.hxx"
 #include "terminol/common/escape.hxx"
+#include "terminol/support/hash.hxx"
 
-Buffer::ParaIter::ParaIter(const Buffer & buffer, APos pos) :
-    _buffer(buffer),
-    _pos(pos),
-    _cells(_buffer.getCols(), Cell::blank())
-{
-    _buffer.getLine(_pos.row, _cells, _cont, _wrap);
-    _valid = _pos.col < _wrap;
-}
+#include <algorithm>
 
-void Buffer::ParaIter::moveForward() {
-    ASSERT(_valid, "Invalid");
+namespace {
 
-    ++_pos.col;
+// Number of stale HParas to reflow at a time.
+const size_t REFLOW_CHUNK = 4096;
 
-    if (_pos.col == _buffer.getCols()) {
-        ++_pos.row;
-        _pos.col = 0;
+// Bounds on the decoded paragraphs in Buffer::_paraCache.
+const size_t PARA_CACHE_PARAS = 1024;
+const size_t PARA_CACHE_CELLS = 256 * 1024;
 
-        if (_cont) {
-            ASSERT(_pos.row < _buffer.getRows(), "");
-            _buffer.getLine(_pos.row, _cells, _cont, _wrap);
-            _valid = _pos.col < _wrap;
-        }
-        else {
-            _valid = false;
-        }
+// Number of pages beyond the viewport to prefetch while scrolling.
+const int32_t PREFETCH_PAGES = 2;
+
+// Number of provisional paragraphs beyond which bump() waits for the Ingester.
+const size_t INGEST_BACKLOG = 4096;
+
+// Number of tags enforceHistoryLimit() accumulates before removing them.
+const size_t RELEASE_BATCH = 256;
+
+// Bound on the stored paragraphs in Buffer::_hspanCache.
+const size_t HSPAN_CACHE_PARAS = 4096;
+
+} // namespace {anonymous}
+
+Buffer::ParaCursor::ParaCursor(const Buffer & buffer, APos pos) :
+    _cells(),
+    _row(pos.row),
+    _cols(buffer.getCols()),
+    _offset(0),
+    _valid(false)
+{
+    // Find the first row of the paragraph.
+    while (_row > 0 && buffer._active[_row - 1].cont) {
+        --_row;
     }
-    else {
-        _valid = _pos.col < _wrap;
+
+    bool active = true;
+
+    if (_row == 0 && !buffer._pending.empty()) {
+        // The paragraph begins in the history.
+        _row = -1;
     }
-}
 
-void Buffer::ParaIter::moveBackward() {
-    ASSERT(_valid, "Invalid");
+    if (_row < 0) {
+        auto   hline = buffer.getHLine(_row);
+        auto & para  = buffer.getPara(hline.index);
+        _row -= hline.seqnum;
 
-    if (_pos.col == 0) {
-        --_pos.row;
-        _pos.col = _buffer.getCols() - 1;
+        // Only the pending paragraph continues into the active region.
+        active = (&para == &buffer._pending);
+        _cells = para;
+    }
 
-        if (_pos.row == -static_cast<int32_t>(_buffer._history.size() + 1)) {
-            _valid = false;
-        }
-        else {
-            _buffer.getLine(_pos.row, _cells, _cont, _wrap);
-            _valid = _cont;
+    if (active) {
+        for (int16_t row = std::max(_row, 0); ; ++row) {
+            auto & aline = buffer._active[row];
+            _cells.insert(_cells.end(), aline.cells.begin(), aline.cells.begin() + aline.wrap);
+            if (!aline.cont) { break; }
         }
     }
-    else {
-        --_pos.col;
-    }
+
+    setOffset((pos.row - _row) * _cols + pos.col);
 }
 
 //
@@ -102,10 +116,13 @@ bool Buffer::BufferIter::isStartOfPara() {
         return true;
     }
 
-    if (prevRow < 0) {
+    if (_row < 0) {
         // Historical.
-        auto & hline = _buffer._history[_buffer._history.size() + prevRow];
-        return hline.seqnum == 0;
+        return _buffer.getHLine(_row).seqnum == 0;
+    }
+    else if (_row == 0) {
+        // First active row, the pending paragraph may continue into it.
+        return _buffer._pending.empty();
     }
     else {
         // Active.
@@ -125,11 +142,31 @@ Buffer::Buffer(const Config       & config,
     _deduper(deduper),
     _destroyer(destroyer),
     _tags(),
-    _lostTags(0),
+    _paras(),
+    _reflowIndex(0),
+    _lengths(),
+    _historyCells(0),
+    _lostRows(0),
+    _lostParas(0),
+    _prompts(),
+    _historyRows(0),
     _pending(),
-    _history(),
+    _provisional(),
+    _ingester(nullptr),
+    _released(),
+    _paraCache(),
+    _paraCacheCells(0),
+    _paraCacheHits(0),
+    _paraCacheMisses(0),
+    _highlighters(),
+    _hspanCache(),
+    _prefetcher(nullptr),
+    _scrollDirection(0),
     _active(rows, ALine(cols)),
+    _frozen(),
     _damage(rows),
+    _snapshot(rows, 0),
+    _move(),
     _tabs(cols),
     _scrollOffset(0),
     _historyLimit(historyLimit),
@@ -140,17 +177,48 @@ Buffer::Buffer(const Config       & config,
     _cursor(),
     _savedCursor(),
     _charSubs(charSubs),
-    _search(nullptr)
+    _search(nullptr),
+    _searcher(nullptr),
+    _dispatchedRows(0),
+    _skippedRows(0)
 {
     resetMargins();
     resetTabs();
+
+    // The patterns were checked by the Parser.
+    for (auto & highlight : _config.highlights) {
+        _highlighters.push_back(new Regex(highlight.pattern));
+    }
 }
 
 Buffer::~Buffer() {
     if (_search) {
-        delete _search;
+        endSearch();
+    }
+
+    if (_searcher) {
+        delete _searcher;
+    }
+
+    for (auto highlighter : _highlighters) {
+        delete highlighter;
+    }
+
+    // Finish with our tags before they are handed over to the destroyer.
+    if (_prefetcher) {
+        delete _prefetcher;
+    }
+
+    if (_ingester) {
+        resolveParas(0);
+        delete _ingester;
     }
 
+    // The tags released but not yet removed go with the rest, as do those
+    // of the active lines if hibernating.
+    _tags.insert(_tags.end(), _released.begin(), _released.end());
+    _tags.insert(_tags.end(), _frozen.begin(), _frozen.end());
+
     class Garbage : public AsyncDestroyer::Garbage {
     private:
         I_Deduper                & _deduper;
@@ -158,16 +226,16 @@ Buffer::~Buffer() {
     public:
         Garbage(I_Deduper                   & deduper,
                 std::deque<I_Deduper::Tag> && tags) :
-            _deduper(deduper), _tags(tags) {}
+            _deduper(deduper), _tags(std::move(tags)) {}
 
         ~Garbage() override {
-            for (auto tag : _tags) {
-                // Deregister all of our valid tags. Note, really only the last tags can
-                // be invalid.
-                if (tag != I_Deduper::invalidTag()) {
-                    _deduper.remove(tag);
-                }
-            }
+            // Deregister all of our valid tags at once. Note, really only the last
+            // tags can be invalid.
+            std::vector<I_Deduper::Tag> tags;
+            tags.reserve(_tags.size());
+            std::copy_if(_tags.begin(), _tags.end(), back_inserter(tags),
+                         [](I_Deduper::Tag tag) { return tag != I_Deduper::invalidTag(); });
+            _deduper.removeBatch(tags.data(), tags.size());
         }
     };
 
@@ -179,12 +247,16 @@ Buffer::~Buffer() {
 //
 
 void Buffer::markSelection(Pos pos) {
-    damageSelection();
+    APos oldBegin, oldEnd;
+    auto oldValid = normaliseSelection(oldBegin, oldEnd);
+
     _selectMark = _selectDelim = APos(pos, _scrollOffset);
+    damageSelectionChange(oldValid, oldBegin, oldEnd);
 }
 
 void Buffer::delimitSelection(Pos pos, bool initial) {
-    damageSelection();
+    APos oldBegin, oldEnd;
+    auto oldValid = normaliseSelection(oldBegin, oldEnd);
 
     APos apos(pos, _scrollOffset);
 
@@ -218,13 +290,14 @@ void Buffer::delimitSelection(Pos pos, bool initial) {
     }
 
     _selectDelim = apos;
-    damageSelection();
+    damageSelectionChange(oldValid, oldBegin, oldEnd);
 }
 
 void Buffer::expandSelection(Pos pos, int level) {
     level = level % 4;
 
-    damageSelection();
+    APos oldBegin, oldEnd;
+    auto oldValid = normaliseSelection(oldBegin, oldEnd);
 
     if (_selectDelim < _selectMark) {
         std::swap(_selectMark, _selectDelim);
@@ -232,28 +305,23 @@ void Buffer::expandSelection(Pos pos, int level) {
 
     APos apos(pos, _scrollOffset);
 
-    ParaIter iter(*this, apos);
+    ParaCursor cursor(*this, apos);
 
     if (level == 1) {
         _selectMark = _selectDelim = apos;
     }
-    else if (level == 3    ||
-             !iter.valid() ||
-             iter.getCell().seq.lead() == ' ') {
-        ParaIter selectIter(*this, APos(apos.row, 0));
-
-        if (selectIter.valid()) {
-            auto delimIter = selectIter;
+    else if (level == 3      ||
+             !cursor.valid() ||
+             cursor.getCell().seq.lead() == ' ') {
+        cursor.setOffset(cursor.getOffset() - apos.col);
 
-            do {
-                _selectMark = selectIter.getPos();
-                selectIter.moveBackward();
-            } while (selectIter.valid());
+        if (cursor.valid()) {
+            // Select the whole paragraph.
+            cursor.setOffset(0);
+            _selectMark = cursor.getPos();
 
-            do {
-                _selectDelim = delimIter.getPos();
-                delimIter.moveForward();
-            } while (delimIter.valid());
+            cursor.setOffset(cursor.getCells().size() - 1);
+            _selectDelim = cursor.getPos();
 
             _selectDelim.col = getCols();
         }
@@ -264,40 +332,43 @@ void Buffer::expandSelection(Pos pos, int level) {
     else {
         Regex regex("[" + _config.cutChars + "]");
 
-        auto selectIter = iter;
-        auto delimIter  = iter;
+        auto offset = cursor.getOffset();
 
         do {
-            auto & seq  = selectIter.getCell().seq;
+            auto & seq  = cursor.getCell().seq;
             auto   text = reinterpret_cast<const char *>(&seq.bytes[0]);
             auto   size = static_cast<size_t>(utf8::leadLength(seq.lead()));
             if (!regex.matchTest(text, size)) { break; }
-            _selectMark = selectIter.getPos();
-            selectIter.moveBackward();
-        } while (selectIter.valid());
+            _selectMark = cursor.getPos();
+            cursor.moveBackward();
+        } while (cursor.valid());
+
+        cursor.setOffset(offset);
 
         do {
-            auto & seq  = delimIter.getCell().seq;
+            auto & seq  = cursor.getCell().seq;
             auto   text = reinterpret_cast<const char *>(&seq.bytes[0]);
             auto   size = static_cast<size_t>(utf8::leadLength(seq.lead()));
             if (!regex.matchTest(text, size)) { break; }
-            delimIter.moveForward();
-            _selectDelim = delimIter.getPos();
-        } while (delimIter.valid());
+            cursor.moveForward();
+            _selectDelim = cursor.getPos();
+        } while (cursor.valid());
     }
 
-    damageSelection();
+    damageSelectionChange(oldValid, oldBegin, oldEnd);
 }
 
 void Buffer::clearSelection() {
-    damageSelection();
+    APos oldBegin, oldEnd;
+    auto oldValid = normaliseSelection(oldBegin, oldEnd);
 
     // Retain the selection marker, if it is within the history.
-    if (static_cast<int32_t>(_history.size()) + _selectMark.row < 0) {
+    if (static_cast<int32_t>(_historyRows) + _selectMark.row < 0) {
         _selectMark = APos();
     }
 
     _selectDelim = _selectMark;
+    damageSelectionChange(oldValid, oldBegin, oldEnd);
 }
 
 bool Buffer::getSelectedText(std::string & text) const {
@@ -333,22 +404,122 @@ bool Buffer::getSelectedText(std::string & text) const {
     }
 }
 
+std::shared_ptr<SelectedText> Buffer::copySelection() {
+    APos begin, end;
+
+    if (!normaliseSelection(begin, end)) {
+        return nullptr;
+    }
+
+    // Clip the selection to the history that remains.
+    APos top(-static_cast<int32_t>(_historyRows), 0);
+
+    if (begin < top) {
+        if (!(top < end)) {
+            return nullptr;
+        }
+
+        begin = top;
+    }
+
+    size_t   beginIndex, endIndex;
+    uint32_t beginOffset, endOffset;
+    getPosPara(begin, beginIndex, beginOffset);
+    getPosPara(end,   endIndex,   endOffset);
+
+    // Hold the stored paragraphs by tag, and copy the rest.
+    auto provisionalIndex = getProvisionalIndex();
+
+    std::vector<I_Deduper::Tag>    tags;
+    std::vector<std::vector<Cell>> paras;
+    size_t                         cells = 0;
+
+    for (auto i = beginIndex; i <= endIndex && i < provisionalIndex; ++i) {
+        tags.push_back(_tags[i]);
+        cells += _paras[i].length;
+    }
+
+    if (endIndex >= provisionalIndex) {
+        // The paragraphs that aren't stored, as for getHistory().
+        std::vector<std::vector<Cell>> unstored(_provisional.begin(), _provisional.end());
+        std::vector<Cell>              para(_pending);
+
+        for (auto & aline : _active) {
+            para.insert(para.end(), aline.cells.begin(), aline.cells.begin() + aline.wrap);
+
+            if (!aline.cont) {
+                unstored.push_back(std::move(para));
+                para.clear();
+            }
+        }
+
+        if (!para.empty()) {
+            unstored.push_back(std::move(para));
+        }
+
+        if (endIndex - provisionalIndex >= unstored.size()) {
+            // Beyond the last paragraph.
+            endIndex  = provisionalIndex + unstored.size() - 1;
+            endOffset = std::numeric_limits<uint32_t>::max();
+        }
+
+        for (auto i = std::max(beginIndex, provisionalIndex); i <= endIndex; ++i) {
+            cells += unstored[i - provisionalIndex].size();
+            paras.push_back(std::move(unstored[i - provisionalIndex]));
+        }
+    }
+
+    if (!tags.empty()) {
+        _deduper.retainBatch(&tags.front(), tags.size());
+    }
+
+    return std::make_shared<SelectedText>(_deduper, std::move(tags), std::move(paras),
+                                          beginOffset, endOffset,
+                                          cells - std::min<size_t>(cells, beginOffset));
+}
+
 void Buffer::clearHistory() {
-    if (_history.empty()) {
+    if (_historyRows == 0) {
         return;
     }
 
+    if (_prefetcher) {
+        _prefetcher->cancel();
+    }
+
+    resolveParas(0);
+    ASSERT(_provisional.empty(), "");
+
     for (auto tag : _tags) {
         if (LIKELY(tag != I_Deduper::invalidTag())) {
-            _deduper.remove(tag);
+            _released.push_back(tag);
         }
     }
 
+    releaseTags();
+
+    // Damage the selection while its rows still exist.
+    clearSelection();
+
+    // The pending paragraph becomes the first active one.
+    _lostParas += _tags.size() - (_pending.empty() ? 0 : 1);
+    trimPrompts();
+
     _tags.clear();
-    _history.clear();
+    _paras.clear();
+    _reflowIndex = 0;
+    _lengths.clear();
+    _historyCells = 0;
+    _historyRows = 0;
+    _paraCache.clear();
+    _paraCacheCells = 0;
+    _hspanCache.clear();
     _pending.clear();
 
-    clearSelection();
+    if (_selectMark.row < 0) {
+        // The selection marker was within the history.
+        _selectMark = _selectDelim = APos();
+    }
 
     if (_scrollOffset == 0) {
         _barDamage = true;
@@ -357,9 +528,205 @@ void Buffer::clearHistory() {
         _scrollOffset = 0;
         damageViewport(true);
     }
+
+    if (_search) {
+        // The matches were all in the history.
+        releaseSearchHistory();
+        startSearch();
+    }
+}
+
+void Buffer::trimHistory(size_t cells) {
+    // Count the oldest stored paragraphs, never the pending one.
+    auto   stored  = _tags.size() - (_pending.empty() ? 0 : 1);
+    size_t count   = 0;
+    size_t trimmed = 0;
+
+    while (trimmed < cells && count != stored) {
+        trimmed += _paras[count++].length;
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    auto oldScrollOffset = _scrollOffset;
+
+    enforceHistoryLimit(_tags.size() - count);
+    releaseTags();
+
+    _barDamage = true;
+
+    if (_scrollOffset != oldScrollOffset) {
+        damageViewport(true);
+    }
+}
+
+void Buffer::getHistory(std::vector<I_Deduper::Tag>    & tags,
+                        std::vector<std::vector<Cell>> & paras) const {
+    uint32_t lost;
+    getHistory(0, lost, tags, paras);
+}
+
+uint32_t Buffer::getHistory(uint32_t                         since,
+                            uint32_t                       & lost,
+                            std::vector<I_Deduper::Tag>    & tags,
+                            std::vector<std::vector<Cell>> & paras) const {
+    auto provisionalIndex = getProvisionalIndex();
+    auto first            = std::min<size_t>(since > _lostParas ? since - _lostParas : 0,
+                                             provisionalIndex);
+
+    lost = _lostParas;
+    tags.assign(_tags.begin() + first, _tags.begin() + provisionalIndex);
+    paras.assign(_provisional.begin(), _provisional.end());
+
+    // The pending paragraph continues into the active region.
+    std::vector<Cell> para(_pending);
+    std::vector<Cell> scratch;
+
+    for (size_t i = 0; i != _active.size(); ++i) {
+        auto & aline = _active[i];
+        auto   cells = &aline.cells;
+
+        if (isHibernating()) {
+            scratch.clear();
+            _deduper.lookup(_frozen[i], scratch);
+            cells = &scratch;
+        }
+
+        para.insert(para.end(), cells->begin(), cells->begin() + aline.wrap);
+
+        if (!aline.cont) {
+            paras.push_back(std::move(para));
+            para.clear();
+        }
+    }
+
+    if (!para.empty()) {
+        paras.push_back(std::move(para));
+    }
+
+    // Drop the blank lines below the last output.
+    while (!paras.empty() && paras.back().empty()) {
+        paras.pop_back();
+    }
+
+    return static_cast<uint32_t>(_lostParas + provisionalIndex);
+}
+
+void Buffer::restoreHistory(const std::vector<I_Deduper::Tag> & tags) {
+    ASSERT(_tags.empty(), "History must be restored before any is added.");
+
+    for (auto tag : tags) {
+        ASSERT(tag != I_Deduper::invalidTag(), "");
+        uint32_t length = _deduper.lookupLength(tag);
+
+        _tags.push_back(tag);
+        _paras.push_back(HPara(length, _historyRows + _lostRows));
+        addLength(length);
+        _historyRows += getLengthRows(length);
+    }
+
+    enforceHistoryLimit(_historyLimit);
+    releaseTags();
+
+    _barDamage = true;
+}
+
+void Buffer::hibernate() {
+    ASSERT(!isHibernating(), "Already hibernating.");
+    ASSERT(!_search, "Can't hibernate while searching.");
+
+    // Finish with the background threads, they are recreated on demand.
+    if (_prefetcher) {
+        delete _prefetcher;
+        _prefetcher = nullptr;
+    }
+
+    if (_ingester) {
+        resolveParas(0);
+        delete _ingester;
+        _ingester = nullptr;
+    }
+
+    if (_searcher) {
+        delete _searcher;
+        _searcher = nullptr;
+    }
+
+    releaseTags();
+
+    _paraCache.clear();
+    _paraCacheCells = 0;
+    _hspanCache.clear();
+
+    // Store the active lines. Blank lines, the majority of an idle screen,
+    // share an entry.
+    std::vector<const std::vector<Cell> *> cells;
+    cells.reserve(_active.size());
+
+    for (auto & aline : _active) {
+        cells.push_back(&aline.cells);
+    }
+
+    _frozen.resize(_active.size());
+    _deduper.storeBatch(cells.data(), cells.size(), _frozen.data());
+
+    for (auto & aline : _active) {
+        std::vector<Cell>().swap(aline.cells);
+    }
+
+    std::vector<Damage>().swap(_damage);
+    std::vector<uint64_t>().swap(_snapshot);
+    std::vector<I_Deduper::Tag>().swap(_released);
+}
+
+void Buffer::thaw() {
+    ASSERT(isHibernating(), "Not hibernating.");
+
+    for (size_t i = 0; i != _active.size(); ++i) {
+        auto & aline = _active[i];
+        _deduper.lookup(_frozen[i], aline.cells);
+        ASSERT(aline.cells.size() == static_cast<size_t>(_cols), "");
+    }
+
+    _deduper.removeBatch(_frozen.data(), _frozen.size());
+    std::vector<I_Deduper::Tag>().swap(_frozen);
+
+    // Any damage still to be drawn was lost, so draw everything.
+    _damage.resize(_active.size());
+    _snapshot.assign(_active.size(), 0);
+    _move.reset();
+    damageViewport(true);
+}
+
+size_t Buffer::getResidentBytes() const {
+    size_t bytes = sizeof *this;
+
+    bytes += _tags.size() * sizeof(I_Deduper::Tag);
+    bytes += _paras.size() * sizeof(HPara);
+    bytes += _pending.capacity() * sizeof(Cell);
+
+    for (auto & para : _provisional) {
+        bytes += para.capacity() * sizeof(Cell);
+    }
+
+    bytes += _paraCacheCells * sizeof(Cell);
+
+    for (auto & aline : _active) {
+        bytes += sizeof aline + aline.cells.capacity() * sizeof(Cell);
+    }
+
+    bytes += _frozen.capacity() * sizeof(I_Deduper::Tag);
+    bytes += _damage.capacity() * sizeof(Damage);
+    bytes += _snapshot.capacity() * sizeof(uint64_t);
+    bytes += _tabs.capacity() / 8;
+
+    return bytes;
 }
 
 bool Buffer::scrollUpHistory(uint16_t rows) {
+    damageCell();       // The cursor's pixels may be moved.
     auto oldScrollOffset = _scrollOffset;
 
     if (_scrollOffset + rows > getHistoricalRows()) {
@@ -370,7 +737,11 @@ bool Buffer::scrollUpHistory(uint16_t rows) {
     }
 
     if (_scrollOffset != oldScrollOffset) {
-        damageViewport(true);
+        // The content moves down.
+        auto delta = std::min<uint32_t>(_scrollOffset - oldScrollOffset, getRows());
+        damageMove(0, getRows(), -static_cast<int16_t>(delta));
+        _barDamage = true;
+        prefetchHistory(1);
         return true;
     }
     else {
@@ -379,6 +750,7 @@ bool Buffer::scrollUpHistory(uint16_t rows) {
 }
 
 bool Buffer::scrollDownHistory(uint16_t rows) {
+    damageCell();       // The cursor's pixels may be moved.
     auto oldScrollOffset = _scrollOffset;
 
     if (rows > _scrollOffset) {
@@ -389,7 +761,11 @@ bool Buffer::scrollDownHistory(uint16_t rows) {
     }
 
     if (_scrollOffset != oldScrollOffset) {
-        damageViewport(true);
+        // The content moves up.
+        auto delta = std::min<uint32_t>(oldScrollOffset - _scrollOffset, getRows());
+        damageMove(0, getRows(), static_cast<int16_t>(delta));
+        _barDamage = true;
+        prefetchHistory(-1);
         return true;
     }
     else {
@@ -419,10 +795,61 @@ bool Buffer::scrollBottomHistory() {
     }
 }
 
+void Buffer::markPrompt() {
+    size_t   index;
+    uint32_t offset;
+    getPosPara(APos(_cursor.pos.row, _cursor.pos.col), index, offset);
+
+    auto prompt = static_cast<uint32_t>(_lostParas + index);
+
+    // Forget the prompts of paragraphs that have since been erased, e.g. by
+    // clearing the screen.
+    while (!_prompts.empty() && _prompts.back() > prompt) {
+        _prompts.pop_back();
+    }
+
+    if (_prompts.empty() || _prompts.back() != prompt) {
+        _prompts.push_back(prompt);
+    }
+}
+
+bool Buffer::scrollPrevPrompt() {
+    size_t   index;
+    uint32_t offset;
+    getPosPara(APos(-static_cast<int32_t>(_scrollOffset), 0), index, offset);
+
+    // If the top row is within a paragraph then its start is above.
+    auto top  = static_cast<uint32_t>(_lostParas + index);
+    auto iter = std::lower_bound(_prompts.begin(), _prompts.end(), offset == 0 ? top : top + 1);
+
+    if (iter == _prompts.begin()) {
+        return false;
+    }
+
+    return scrollToPrompt(*--iter);
+}
+
+bool Buffer::scrollNextPrompt() {
+    size_t   index;
+    uint32_t offset;
+    getPosPara(APos(-static_cast<int32_t>(_scrollOffset), 0), index, offset);
+
+    auto top  = static_cast<uint32_t>(_lostParas + index);
+    auto iter = std::upper_bound(_prompts.begin(), _prompts.end(), top);
+
+    if (iter == _prompts.end()) {
+        return false;
+    }
+
+    return scrollToPrompt(*iter);
+}
+
 void Buffer::migrateFrom(Buffer & other, bool clear_) {
     other.clearSelection();
     _cursor          = other._cursor;
     _cursor.wrapNext = false;
+    resetSnapshot();        // The other buffer's content is on display.
+    _move.reset();
     if (clear_) {
         clear();
         _barDamage = true;
@@ -667,6 +1094,8 @@ void Buffer::resizeClip(int16_t rows, int16_t cols) {
     _savedCursor.cursor.pos.col = std::min<int16_t>(_savedCursor.cursor.pos.col, cols - 1);
 
     _damage.resize(rows);
+    _snapshot.assign(rows, 0);
+    _move.reset();
     damageViewport(false);
 }
 
@@ -722,18 +1151,18 @@ void Buffer::resizeReflow(int16_t rows, int16_t cols) {
         ASSERT(!_tags.empty(), "");
         ASSERT(_pending.empty(), "");
 
-        _cols = cols;       // Must set before calling rebuildHistory().
-        rebuildHistory();
+        _cols = cols;       // Must set before calling reflowHistory().
+        reflowHistory();
 
         doneCursor = false;
 
         // Pull rows out of history first.
-        while (getRows() < rows && !_history.empty()) {
+        while (getRows() < rows && _historyRows != 0) {
             if (doneCursor) {
                 ++_cursor.pos.row;
             }
             else if (_tags.size() - 1 == cursorTagIndex) {
-                auto & hline = _history.back();
+                auto hline = getHLine(-1);
                 uint32_t offset = hline.seqnum * cols;
                 if (cursorOffset == offset + cols) {
                     _cursor.pos.row  = 0;
@@ -773,7 +1202,7 @@ void Buffer::resizeReflow(int16_t rows, int16_t cols) {
     else {
         if (getRows() < rows) {
             // Pull rows out of history first.
-            while (getRows() < rows && !_history.empty()) {
+            while (getRows() < rows && _historyRows != 0) {
                 ++_cursor.pos.row;
                 unbump();
             }
@@ -798,7 +1227,7 @@ void Buffer::resizeReflow(int16_t rows, int16_t cols) {
 
     _active.shrink_to_fit();
 
-    _scrollOffset = std::min<uint32_t>(_scrollOffset, _history.size());
+    _scrollOffset = std::min<uint32_t>(_scrollOffset, _historyRows);
 
     resetMargins();
 
@@ -812,6 +1241,8 @@ void Buffer::resizeReflow(int16_t rows, int16_t cols) {
     _savedCursor.cursor.pos.col = std::min<int16_t>(_savedCursor.cursor.pos.col, cols - 1);
 
     _damage.resize(rows);
+    _snapshot.assign(rows, 0);
+    _move.reset();
     damageViewport(true);
 }
 
@@ -1080,6 +1511,10 @@ void Buffer::damageViewport(bool scrollbar) {
     }
 }
 
+void Buffer::resetSnapshot() {
+    std::fill(_snapshot.begin(), _snapshot.end(), 0);
+}
+
 void Buffer::damageActive() {
     damageRows(0, getRows());
 }
@@ -1118,11 +1553,24 @@ void Buffer::accumulateDamage(Region & damage) const {
 
         ++rowNum;
     }
+
+    if (_move.rows != 0) {
+        damage.accommodateRow(_move.begin,   0, getCols());
+        damage.accommodateRow(_move.end - 1, 0, getCols());
+    }
 }
 
 void Buffer::dispatch(bool reverse, I_Renderer & renderer) {
-        dispatchBg(reverse, renderer);
-        dispatchFg(reverse, renderer);
+        if (_move.rows != 0) {
+            if (renderer.bufferMoveRows(_move.begin, _move.end, _move.rows)) {
+                _move.reset();
+            }
+            else {
+                cancelMove();
+            }
+        }
+
+        dispatchRows(reverse, renderer);
 
         if (_search) {
             dispatchSearch(reverse, renderer);
@@ -1134,6 +1582,16 @@ void Buffer::dispatch(bool reverse, I_Renderer & renderer) {
         resetDamage();
 }
 
+void Buffer::getDispatchStats(uint32_t & dispatchedRows, uint32_t & skippedRows) const {
+    dispatchedRows = _dispatchedRows;
+    skippedRows    = _skippedRows;
+}
+
+void Buffer::getParaCacheStats(uint32_t & hits, uint32_t & misses) const {
+    hits   = _paraCacheHits;
+    misses = _paraCacheMisses;
+}
+
 void Buffer::resetDamage() {
     for (auto & d : _damage) {
         d.reset();
@@ -1155,69 +1613,83 @@ const CharSub * Buffer::getCharSub(CharSet charSet) const {
 
 void Buffer::beginSearch(const std::string & pattern) {
     ASSERT(!_search, "Already searching.");
-    _search = new Search(*this, pattern);
-    _damage.back().damageAdd(0, getCols());
-
-    auto & bufferIter = _search->iter;
-    auto & allOffsets = _search->allOffsets;
-
-    Regex regex(pattern);
-
-    while (bufferIter.valid()) {
-        auto paraIter = bufferIter.getParaIter();
-
-        std::vector<uint8_t> para;
+    _search = new Search(pattern);
+    startSearch();
+}
 
-        while (paraIter.valid()) {
-            auto & cell = paraIter.getCell();
-            auto   seq  = cell.seq;
+const std::string & Buffer::getSearchPattern() const {
+    ASSERT(_search, "Not searching.");
+    return _search->pattern;
+}
 
-            std::copy(&seq.bytes[0],
-                      &seq.bytes[utf8::leadLength(seq.lead())],
-                      back_inserter(para));
+void Buffer::setSearchPattern(const std::string & pattern) {
+    ASSERT(_search, "Not searching.");
 
-            paraIter.moveForward();
-        }
+    if (_search->pattern != pattern) {
+        _search->pattern = pattern;
+        startSearch();
+    }
+}
 
-        para.push_back('\0');
+bool Buffer::isSearchRunning() const {
+    ASSERT(_search, "Not searching.");
+    return _search->running;
+}
 
-        std::cout << &para.front() << std::endl;
+bool Buffer::updateSearch() {
+    ASSERT(_search, "Not searching.");
 
-        // PCRE_NOTEMPTY, PCRE_NO_UTF8_CHECK
-        allOffsets = regex.matchAllOffsets(reinterpret_cast<const char *>(&para.front()),
-                                           para.size());
+    if (!_search->running) {
+        return false;
+    }
 
-        if (!allOffsets.empty()) {
-            break;
-        }
+    auto & matches = _search->matches;
+    auto   size    = matches.size();
 
-        bufferIter.moveBackward();
+    if (_searcher->collect(matches)) {
+        _search->running = false;
+        stopSearch();
     }
-}
 
-const std::string & Buffer::getSearchPattern() const {
-    ASSERT(_search, "Not searching.");
-    return _search->pattern;
-}
+    if (size == 0 && !matches.empty()) {
+        showSearchMatch();
+    }
 
-void Buffer::setSearchPattern(const std::string & pattern) {
-    ASSERT(_search, "Not searching.");
-    _search->pattern = pattern;
-    // TODO
+    if (matches.size() != size || !_search->running) {
+        _damage.back().damageAdd(0, getCols());
+        return true;
+    }
+    else {
+        return false;
+    }
 }
 
 void Buffer::nextSearch() {
     ASSERT(_search, "Not searching.");
-    NYI("");
+    updateSearch();
+
+    if (_search->current + 1 < _search->matches.size()) {
+        ++_search->current;
+        showSearchMatch();
+        _damage.back().damageAdd(0, getCols());
+    }
 }
 
 void Buffer::prevSearch() {
     ASSERT(_search, "Not searching.");
-    NYI("");
+    updateSearch();
+
+    if (_search->current != 0) {
+        --_search->current;
+        showSearchMatch();
+        _damage.back().damageAdd(0, getCols());
+    }
 }
 
 void Buffer::endSearch() {
     ASSERT(_search, "Not searching.");
+    releaseSearchHistory();
+    _damage.back().damageAdd(0, getCols());
     delete _search;
     _search = nullptr;
 }
@@ -1237,7 +1709,7 @@ void Buffer::dumpTags(std::ostream & ost) const {
             << std::setfill(' ') << std::dec << " \'";
 
         if (tag == I_Deduper::invalidTag()) {
-            cells = _pending;
+            cells = getPara(i);
         }
         else {
             _deduper.lookup(tag, cells);
@@ -1261,21 +1733,22 @@ void Buffer::dumpHistory(std::ostream & ost) const {
     ost << "BEGIN HISTORY" << std::endl;
 
     auto              flags = ost.flags();
-    size_t            i = 0;
     std::vector<Cell> cells;
 
-    for (auto & l : _history) {
+    for (uint32_t i = 0; i != _historyRows; ++i) {
+        auto l = getHLine(static_cast<int32_t>(i) - static_cast<int32_t>(_historyRows));
+
         ost << std::setw(4) << i << " "
-            << std::setw(4) << l.index - _lostTags << " "
+            << std::setw(4) << l.index << " "
             << std::setw(2) << l.seqnum << " \'";
 
-        auto     tag    = _tags[l.index - _lostTags];
+        auto     tag    = _tags[l.index];
         uint32_t offset = l.seqnum * getCols();
         bool     cont;
         int16_t  wrap;
 
         if (tag == I_Deduper::invalidTag()) {
-            cells = _pending;
+            cells = getPara(l.index);
             cont  = true;
             wrap  = getCols();
         }
@@ -1292,8 +1765,6 @@ void Buffer::dumpHistory(std::ostream & ost) const {
         }
 
         ost << "\'" << std::endl;
-
-        ++i;
     }
 
     ost.flags(flags);
@@ -1340,20 +1811,17 @@ void Buffer::dumpSelection(std::ostream & ost) const {
 
 void Buffer::getLine(int32_t row, std::vector<Cell> & cells, bool & cont, int16_t & wrap) const {
     if (row < 0) {
-        auto & hline = _history[_history.size() + row];
-        auto   tag   = _tags[hline.index - _lostTags];
+        auto hline = getHLine(row);
 
         uint32_t offset = hline.seqnum * getCols();
 
-        if (UNLIKELY(tag == I_Deduper::invalidTag())) {
-            wrap = std::min<uint32_t>(getCols(), _pending.size() - offset);
-            std::copy(_pending.begin() + offset, _pending.begin() + offset + wrap, cells.begin());
-            std::fill(cells.begin() + wrap, cells.end(), Cell::blank());
-            cont = (offset + wrap != _pending.size());
-        }
-        else {
-            _deduper.lookupSegment(tag, offset, getCols(), cells, cont, wrap);
-        }
+        auto & para = getPara(hline.index);
+
+        wrap = std::min<uint32_t>(getCols(), para.size() - offset);
+        std::copy(para.begin() + offset, para.begin() + offset + wrap, cells.begin());
+        std::fill(cells.begin() + wrap, cells.end(), Cell::blank());
+        // The pending paragraph always continues into the active region.
+        cont = (&para == &_pending || offset + wrap != para.size());
     }
     else {
         auto & aline = _active[row];
@@ -1364,157 +1832,395 @@ void Buffer::getLine(int32_t row, std::vector<Cell> & cells, bool & cont, int16_
     }
 }
 
-void Buffer::dispatchBg(bool reverse, I_Renderer & renderer) const {
-    APos selBegin, selEnd;
-    auto selValid = normaliseSelection(selBegin, selEnd);
+int16_t Buffer::getWrap(int32_t row) const {
+    if (row < 0) {
+        auto hline = getHLine(row);
 
-    // Declare this outside of the loop to avoid reallocation.
-    std::vector<Cell> cells(getCols(), Cell::blank());
+        // The pending paragraph's length is not kept in its HPara.
+        uint32_t length =
+            hline.index + 1 == _tags.size() && !_pending.empty() ?
+            _pending.size() :
+            _paras[hline.index].length;
 
-    for (int16_t row = 0; row != getRows(); ++row) {
-        auto & damage = _damage[row];
-        if (damage.begin == damage.end) { continue; }
-
-        bool    cont;
-        int16_t wrap;
-        getLine(static_cast<int32_t>(row - _scrollOffset), cells, cont, wrap);
+        return std::min<uint32_t>(getCols(), length - hline.seqnum * getCols());
+    }
+    else {
+        return _active[row].wrap;
+    }
+}
 
-        auto bg0  = UColor::stock(UColor::Name::TEXT_BG);
-        auto col0 = damage.begin;  // Accumulation start column.
-        auto col1 = col0;
-
-        for (; col1 != damage.end; ++col1) {
-#if 0
-            // Once we get past the wrap point all cells should be the same, so skip
-            // to the last iteration. Unlike in dispatchFg() we must iterate over
-            // the wrap character to handle selection correctly.
-            if (col1 > wrap) { col1 = damage.end - 1; }
-#endif
-
-            auto   apos     = APos(row - _scrollOffset, col1);
-            auto   selected = selValid && isCellSelected(apos, selBegin, selEnd, wrap);
-            auto & cell     = cells[col1];
-            auto & attrs    = cell.style.attrs;
-            auto   swap     = XOR(reverse, attrs.get(Attr::INVERSE));
-            auto   bg1      = bg0; // About to be overridden.
-
-            if (UNLIKELY(selected)) {
-                if (_config.customSelectBgColor) {
-                    bg1 = UColor::stock(UColor::Name::SELECT_BG);
-                }
-                else if (_config.customSelectFgColor) {
-                    bg1 = swap ? cell.style.fg : cell.style.bg;
-                }
-                else {
-                    bg1 = !swap ? cell.style.fg : cell.style.bg;
-                }
-            }
-            else {
-                bg1 = swap ? cell.style.fg : cell.style.bg;
-            }
+uint64_t Buffer::hashRow(int16_t row, const std::vector<Cell> & cells,
+                         bool reverse, int16_t selCol0, int16_t selCol1) const {
+    // Hash everything that influences how this row is drawn: the cells
+    // and anything that dispatchBg(), dispatchFg(), dispatchCursor() and
+    // dispatchSearch() overlay on them.
+    auto mix = [](uint64_t val, const void * data, size_t size) {
+        auto bytes = static_cast<const uint8_t *>(data);
+        return std::accumulate(bytes, bytes + size, val, SDBM<uint64_t>());
+    };
 
-            if (UNLIKELY(bg0 != bg1)) {
-                if (col1 != col0) {
-                    // flush run
-                    renderer.bufferDrawBg(Pos(row, col0), col1 - col0, bg0);
-                }
+    auto val = mix(0, &cells.front(), cells.size() * sizeof(Cell));
+    val = mix(val, &reverse, sizeof reverse);
 
-                col0 = col1;
-                bg0  = bg1;
-            }
-        }
+    if (selCol0 != selCol1) {
+        int16_t sel[] = { selCol0, selCol1 };
+        val = mix(val, sel, sizeof sel);
+    }
 
-        // There may be an unterminated run to flush.
-        if (col1 != col0) {
-            renderer.bufferDrawBg(Pos(row, col0), col1 - col0, bg0);
+    if (_search) {
+        if (row == getRows() - 1) {
+            auto bar = getSearchBar();
+            val = mix(val, bar.data(), bar.size());
         }
     }
+    else if (_scrollOffset + static_cast<uint32_t>(_cursor.pos.row) ==
+             static_cast<uint32_t>(row)) {
+        int16_t cursor[] = { _cursor.pos.col, _cursor.wrapNext };
+        val = mix(val, cursor, sizeof cursor);
+    }
+
+    return val != 0 ? val : 1;      // 0 is reserved for "unknown".
 }
 
-void Buffer::dispatchFg(bool reverse, I_Renderer & renderer) const {
+void Buffer::dispatchRows(bool reverse, I_Renderer & renderer) {
     APos selBegin, selEnd;
     auto selValid = normaliseSelection(selBegin, selEnd);
 
     // Declare these outside of the loop to avoid reallocation.
     std::vector<Cell>    cells(getCols(), Cell::blank());
     std::vector<uint8_t> run;               // Buffer for accumulating character runs.
+    HMemo                memo;
 
     for (int16_t row = 0; row != getRows(); ++row) {
         auto & damage = _damage[row];
         if (damage.begin == damage.end) { continue; }
 
+        // Fetch the line once, it may have to be decoded from history.
         bool    cont;
         int16_t wrap;
         getLine(static_cast<int32_t>(row - _scrollOffset), cells, cont, wrap);
 
-        auto fg0    = UColor::stock(UColor::Name::TEXT_FG);
-        auto attrs0 = AttrSet();
-        auto col0   = damage.begin;   // Accumulation start column.
-        auto col1   = col0;
-
-        for (; col1 != damage.end; ++col1) {
-#if 0
-            // Once we get past the wrap point all cells will be blank,
-            // so break out of the loop now.
-            if (col1 >= wrap) { break; }
-#endif
-
-            auto   apos     = APos(row - _scrollOffset, col1);
-            auto   selected = selValid && isCellSelected(apos, selBegin, selEnd, wrap);
-            auto & cell     = cells[col1];
-            auto   length   = utf8::leadLength(cell.seq.lead());
-            auto & attrs1   = cell.style.attrs;
-            auto   swap     = XOR(reverse, attrs1.get(Attr::INVERSE));
-            auto   fg1      = fg0; // About to be overridden.
-
-            if (UNLIKELY(selected)) {
-                if (_config.customSelectFgColor) {
-                    fg1 = UColor::stock(UColor::Name::SELECT_FG);
-                }
-                else if (_config.customSelectBgColor) {
-                    fg1 = swap ? cell.style.bg : cell.style.fg;
-                }
-                else {
-                    fg1 = !swap ? cell.style.bg : cell.style.fg;
-                }
+        if (!_highlighters.empty()) {
+            highlightLine(static_cast<int32_t>(row - _scrollOffset), cells, memo);
+        }
+
+        int16_t selCol0 = 0, selCol1 = 0;
+        if (selValid) {
+            getSelectedCols(row - _scrollOffset, selBegin, selEnd, wrap, getCols(),
+                            selCol0, selCol1);
+        }
+
+        auto hash = hashRow(row, cells, reverse, selCol0, selCol1);
+
+        if (hash == _snapshot[row]) {
+            // The renderer already has exactly this row.
+            damage.reset();
+            ++_skippedRows;
+            continue;
+        }
+
+        _snapshot[row] = hash;
+        ++_dispatchedRows;
+
+        // The backgrounds of the row must be drawn before its foregrounds.
+        dispatchBg(row, cells, reverse, selCol0, selCol1, renderer);
+        dispatchFg(row, cells, reverse, selCol0, selCol1, run, renderer);
+    }
+}
+
+void Buffer::highlightLine(int32_t row, std::vector<Cell> & cells, HMemo & memo) const {
+    // Find the paragraph of the line and the line's offset within it. The
+    // paragraphs are numbered as by getHistory(), except that those starting
+    // in the active region are numbered by their first line.
+    size_t   index;
+    uint32_t offset = 0;
+    uint32_t size   = cells.size();
+
+    if (row < 0) {
+        auto hline = getHLine(row);
+        index  = hline.index;
+        offset = hline.seqnum * getCols();
+    }
+    else {
+        auto first = static_cast<size_t>(row);
+
+        while (first != 0 && _active[first - 1].cont) {
+            --first;
+            offset += _active[first].wrap;
+        }
+
+        if (first == 0 && !_pending.empty()) {
+            // The line continues the pending paragraph.
+            index   = _tags.size() - 1;
+            offset += _pending.size();
+        }
+        else {
+            index = _tags.size() + first;
+        }
+
+        if (_active[row].cont) {
+            size = _active[row].wrap;
+        }
+    }
+
+    const std::vector<HSpan> * hspans = &memo.hspans;
+
+    if (index < _tags.size() && _tags[index] != I_Deduper::invalidTag()) {
+        auto tag  = _tags[index];
+        auto iter = _hspanCache.find(tag);
+
+        if (iter == _hspanCache.end()) {
+            std::vector<HSpan> scratch;
+            auto & para = getPara(index);
+            matchHighlights(para, para.size(), scratch);
+            iter = _hspanCache.insert(tag, std::move(scratch));
+
+            if (_hspanCache.size() > HSPAN_CACHE_PARAS) {
+                _hspanCache.erase(_hspanCache.begin());
             }
-            else {
-                fg1 = swap ? cell.style.bg : cell.style.fg;
+        }
+
+        hspans = &iter->second;
+    }
+    else if (memo.index != index) {
+        // Pending, provisional or active, so it may yet change. Assemble
+        // the paragraph as getHistory() does.
+        std::vector<Cell> para;
+        size_t            active = _active.size();  // Line continuing the paragraph.
+
+        if (index < _tags.size()) {
+            para = getPara(index);
+
+            if (index + 1 == _tags.size() && !_pending.empty()) {
+                active = 0;
             }
+        }
+        else {
+            active = index - _tags.size();
+        }
 
-            /* If the UTF-8 codepoint is more than one byte then terminate the run
-             * to prevent the alignment being upset when the resulting glyph is
-             * wider than the fixed width font.
-             * Can we do this a better way?
-             */
-            if (UNLIKELY(length != utf8::Length::L1 ||
-                         fg0    != fg1              ||
-                         attrs0 != attrs1)) {
-                if (col1 != col0) {
-                    // flush run
-                    auto size = run.size();
-                    run.push_back(NUL);
-                    renderer.bufferDrawFg(Pos(row, col0), col1 - col0,
-                                          fg0, attrs0, &run.front(), size);
-                    run.clear();
-                }
+        for (auto i = active; i < _active.size(); ++i) {
+            auto & aline = _active[i];
+            para.insert(para.end(), aline.cells.begin(), aline.cells.begin() + aline.wrap);
+
+            if (!aline.cont) {
+                break;
+            }
+        }
+
+        memo.index = index;
+        memo.hspans.clear();
+        matchHighlights(para, para.size(), memo.hspans);
+    }
+
+    for (auto & hspan : *hspans) {
+        auto begin = std::max(hspan.begin, offset);
+        auto end   = std::min(hspan.end, offset + size);
+
+        for (auto i = begin; i < end; ++i) {
+            cells[i - offset].style.fg = hspan.fg;
+        }
+    }
+}
+
+void Buffer::matchHighlights(const std::vector<Cell> & cells, size_t size,
+                             std::vector<HSpan> & hspans) const {
+    // Encode the cells, remembering where each starts.
+    std::vector<char>     text;
+    std::vector<uint32_t> starts;
+
+    for (size_t i = 0; i != size; ++i) {
+        auto & seq = cells[i].seq;
+        starts.push_back(text.size());
+        text.insert(text.end(), &seq.bytes[0], &seq.bytes[utf8::leadLength(seq.lead())]);
+    }
+
+    if (text.empty()) {
+        return;
+    }
+
+    for (size_t h = 0; h != _highlighters.size(); ++h) {
+        auto fg = UColor::direct(_config.highlights[h].fg.r,
+                                 _config.highlights[h].fg.g,
+                                 _config.highlights[h].fg.b);
+
+        for (auto & offsets : _highlighters[h]->matchAllOffsets(&text.front(), text.size())) {
+            auto & whole = offsets.front();
+            uint32_t begin = std::upper_bound(starts.begin(), starts.end(),
+                                              static_cast<uint32_t>(whole.first)) - starts.begin() - 1;
+            uint32_t end   = std::lower_bound(starts.begin(), starts.end(),
+                                              static_cast<uint32_t>(whole.last)) - starts.begin();
+            hspans.emplace_back(begin, end, fg);
+        }
+    }
+}
+
+// The damaged columns of a row are split into those before, within and after
+// the selection. Each is accumulated into runs by an instantiation of
+// accumulateBg()/accumulateFg() that is specialised for how its cells are
+// coloured: SWAP -> fg/bg are swapped (unless the cell is INVERSE),
+// CUSTOM -> the configured selection colour is used.
+
+void Buffer::dispatchBg(int16_t row, const std::vector<Cell> & cells,
+                        bool reverse, int16_t selCol0, int16_t selCol1,
+                        I_Renderer & renderer) const {
+    auto & damage = _damage[row];
+
+    auto bg0  = UColor::stock(UColor::Name::TEXT_BG);
+    auto col0 = damage.begin;  // Accumulation start column.
+
+    auto col1 = clamp(selCol0, damage.begin, damage.end);
+    auto col2 = clamp(selCol1, col1,         damage.end);
+
+    auto plain = [&](int16_t begin, int16_t end, bool swap) {
+        if (swap) {
+            accumulateBg<true,  false>(row, cells, begin, end, bg0, col0, bg0, renderer);
+        }
+        else {
+            accumulateBg<false, false>(row, cells, begin, end, bg0, col0, bg0, renderer);
+        }
+    };
+
+    plain(damage.begin, col1, reverse);
+
+    if (col1 != col2) {
+        if (_config.customSelectBgColor) {
+            accumulateBg<false, true>(row, cells, col1, col2,
+                                      UColor::stock(UColor::Name::SELECT_BG),
+                                      col0, bg0, renderer);
+        }
+        else if (_config.customSelectFgColor) {
+            plain(col1, col2, reverse);
+        }
+        else {
+            plain(col1, col2, !reverse);
+        }
+    }
+
+    plain(col2, damage.end, reverse);
+
+    // There may be an unterminated run to flush.
+    if (damage.end != col0) {
+        renderer.bufferDrawBg(Pos(row, col0), damage.end - col0, bg0);
+    }
+}
 
-                col0   = col1;
-                fg0    = fg1;
-                attrs0 = attrs1;
+template <bool SWAP, bool CUSTOM>
+void Buffer::accumulateBg(int16_t row, const std::vector<Cell> & cells,
+                          int16_t begin, int16_t end, UColor custom,
+                          int16_t & col0, UColor & bg0,
+                          I_Renderer & renderer) const {
+    for (auto col1 = begin; col1 != end; ++col1) {
+        auto & cell = cells[col1];
+        auto   bg1  = custom;
+
+        if (!CUSTOM) {
+            auto swap = XOR(SWAP, cell.style.attrs.get(Attr::INVERSE));
+            bg1 = swap ? cell.style.fg : cell.style.bg;
+        }
+
+        if (UNLIKELY(bg0 != bg1)) {
+            if (col1 != col0) {
+                // flush run
+                renderer.bufferDrawBg(Pos(row, col0), col1 - col0, bg0);
             }
 
-            std::copy(cell.seq.bytes, cell.seq.bytes + length, std::back_inserter(run));
+            col0 = col1;
+            bg0  = bg1;
+        }
+    }
+}
+
+void Buffer::dispatchFg(int16_t row, const std::vector<Cell> & cells,
+                        bool reverse, int16_t selCol0, int16_t selCol1,
+                        std::vector<uint8_t> & run, I_Renderer & renderer) const {
+    auto & damage = _damage[row];
+
+    auto fg0    = UColor::stock(UColor::Name::TEXT_FG);
+    auto attrs0 = AttrSet();
+    auto col0   = damage.begin;   // Accumulation start column.
+
+    auto col1 = clamp(selCol0, damage.begin, damage.end);
+    auto col2 = clamp(selCol1, col1,         damage.end);
+
+    auto plain = [&](int16_t begin, int16_t end, bool swap) {
+        if (swap) {
+            accumulateFg<true,  false>(row, cells, begin, end, fg0,
+                                       col0, fg0, attrs0, run, renderer);
+        }
+        else {
+            accumulateFg<false, false>(row, cells, begin, end, fg0,
+                                       col0, fg0, attrs0, run, renderer);
         }
+    };
+
+    plain(damage.begin, col1, reverse);
+
+    if (col1 != col2) {
+        if (_config.customSelectFgColor) {
+            accumulateFg<false, true>(row, cells, col1, col2,
+                                      UColor::stock(UColor::Name::SELECT_FG),
+                                      col0, fg0, attrs0, run, renderer);
+        }
+        else if (_config.customSelectBgColor) {
+            plain(col1, col2, reverse);
+        }
+        else {
+            plain(col1, col2, !reverse);
+        }
+    }
+
+    plain(col2, damage.end, reverse);
+
+    // There may be an unterminated run to flush.
+    if (damage.end != col0) {
+        // flush run
+        auto size = run.size();
+        run.push_back(NUL);
+        renderer.bufferDrawFg(Pos(row, col0), damage.end - col0, fg0, attrs0, &run.front(), size);
+        run.clear();
+    }
+}
+
+template <bool SWAP, bool CUSTOM>
+void Buffer::accumulateFg(int16_t row, const std::vector<Cell> & cells,
+                          int16_t begin, int16_t end, UColor custom,
+                          int16_t & col0, UColor & fg0, AttrSet & attrs0,
+                          std::vector<uint8_t> & run, I_Renderer & renderer) const {
+    for (auto col1 = begin; col1 != end; ++col1) {
+        auto & cell   = cells[col1];
+        auto   length = utf8::leadLength(cell.seq.lead());
+        auto & attrs1 = cell.style.attrs;
+        auto   fg1    = custom;
+
+        if (!CUSTOM) {
+            auto swap = XOR(SWAP, attrs1.get(Attr::INVERSE));
+            fg1 = swap ? cell.style.bg : cell.style.fg;
+        }
+
+        /* If the UTF-8 codepoint is more than one byte then terminate the run
+         * to prevent the alignment being upset when the resulting glyph is
+         * wider than the fixed width font.
+         * Can we do this a better way?
+         */
+        if (UNLIKELY(length != utf8::Length::L1 ||
+                     fg0    != fg1              ||
+                     attrs0 != attrs1)) {
+            if (col1 != col0) {
+                // flush run
+                auto size = run.size();
+                run.push_back(NUL);
+                renderer.bufferDrawFg(Pos(row, col0), col1 - col0,
+                                      fg0, attrs0, &run.front(), size);
+                run.clear();
+            }
 
-        // There may be an unterminated run to flush.
-        if (col1 != col0) {
-            // flush run
-            auto size = run.size();
-            run.push_back(NUL);
-            renderer.bufferDrawFg(Pos(row, col0), col1 - col0, fg0, attrs0, &run.front(), size);
-            run.clear();
+            col0   = col1;
+            fg0    = fg1;
+            attrs0 = attrs1;
         }
+
+        std::copy(cell.seq.bytes, cell.seq.bytes + length, std::back_inserter(run));
     }
 }
 
@@ -1558,7 +2264,7 @@ void Buffer::dispatchCursor(bool reverse, I_Renderer & renderer) const {
 void Buffer::dispatchSearch(bool UNUSED(reverse), I_Renderer & renderer) const {
     auto row = getRows() - 1;
 
-    auto str = "?" + _search->pattern;
+    auto str = getSearchBar();
 
     renderer.bufferDrawBg(Pos(row, 0), getCols(), UColor::stock(UColor::Name::TEXT_FG));
     renderer.bufferDrawFg(Pos(row, 0),
@@ -1569,29 +2275,461 @@ void Buffer::dispatchSearch(bool UNUSED(reverse), I_Renderer & renderer) const {
                           str.size());
 }
 
-void Buffer::rebuildHistory() {
-    _history.clear();
+std::string Buffer::getSearchBar() const {
+    auto str = "?" + _search->pattern;
 
-    uint32_t index = 0;
+    if (!_search->valid) {
+        str += "  (invalid)";
+    }
+    else if (!_search->pattern.empty()) {
+        auto & matches = _search->matches;
+        str += "  " + stringify(matches.empty() ? 0 : _search->current + 1) +
+               "/" + stringify(matches.size());
 
-    for (auto tag : _tags) {
-        auto length = (tag != I_Deduper::invalidTag() ?
-                       _deduper.lookupLength(tag) :
-                       _pending.size());
+        if (_search->running) {
+            str += "...";
+        }
+    }
+
+    return str;
+}
 
-        uint16_t seqnum = 0;
-        size_t   offset = 0;
+void Buffer::startSearch() {
+    stopSearch();
 
-        do {
-            _history.push_back(HLine(index + _lostTags, seqnum));
-            ++seqnum;
-            offset += _cols;
-        } while (offset < length);
+    _search->valid   = true;
+    _search->running = false;
+    _search->matches.clear();
+    _search->current = 0;
+    _damage.back().damageAdd(0, getCols());
+
+    if (_search->pattern.empty()) {
+        return;
+    }
+
+    std::unique_ptr<Regex> regex;
+
+    try {
+        regex.reset(new Regex(_search->pattern));
+    }
+    catch (const Regex::Error &) {
+        // Most likely the pattern is still being typed.
+        _search->valid = false;
+        return;
+    }
+
+    if (!_searcher) {
+        _searcher = new Searcher(_deduper);
+    }
+
+    if (!_search->tags) {
+        auto tags  = std::make_shared<std::vector<I_Deduper::Tag>>();
+        auto paras = std::make_shared<std::vector<std::vector<Cell>>>();
+        getHistory(*tags, *paras);
+
+        // The Searcher reads the tags in the background. Hold on to them in
+        // case the history is trimmed in the meantime.
+        _deduper.retainBatch(tags->data(), tags->size());
+        _search->tags      = tags;
+        _search->paras     = paras;
+        _search->lostParas = _lostParas;
+    }
+
+    _search->running = true;
+
+    _searcher->start(std::move(regex), Regex::requiredLiterals(_search->pattern),
+                     _search->tags, _search->paras);
+}
+
+void Buffer::stopSearch() {
+    if (_search->running) {
+        _searcher->cancel();
+        _search->running = false;
+    }
+}
+
+void Buffer::releaseSearchHistory() {
+    stopSearch();
+
+    if (_search->tags) {
+        auto & tags = *_search->tags;
+        _deduper.removeBatch(tags.data(), tags.size());
+        _search->tags.reset();
+        _search->paras.reset();
+    }
+}
+
+void Buffer::showSearchMatch() {
+    auto & match = _search->matches[_search->current];
+    auto   lost  = _lostParas - _search->lostParas;
+
+    APos begin, end;
+
+    if (match.index < lost ||
+        !getParaPos(match.index - lost, match.begin,   begin) ||
+        !getParaPos(match.index - lost, match.end - 1, end)) {
+        // Trimmed from the history since it was searched.
+        return;
+    }
+
+    ++end.col;
+
+    damageSelection();
+    _selectMark  = begin;
+    _selectDelim = end;
+    damageSelection();
+
+    // The search bar covers the last row.
+    auto top    = -static_cast<int32_t>(_scrollOffset);
+    auto bottom = top + getRows() - 1;
+
+    if (begin.row < top || end.row >= bottom) {
+        // Centre the match.
+        auto offset = static_cast<int32_t>(getRows() / 2) - begin.row;
+        _scrollOffset = std::min(static_cast<uint32_t>(std::max(offset, 0)), getHistoricalRows());
+        damageViewport(true);
+    }
+}
+
+void Buffer::reflowHistory() {
+    ASSERT(_pending.empty(), "");
+
+    uint32_t rows = 0;
+
+    for (auto & l : _lengths) {
+        rows += l.second * getLengthRows(l.first);
+    }
+
+    _historyRows = rows;
+    _reflowIndex = _paras.size();
+
+    // Make the most recent history, which is likely to be viewed, valid now.
+    reflowParas(REFLOW_CHUNK);
+}
+
+void Buffer::reflowParas(size_t count) const {
+    auto end = _reflowIndex - std::min(count, _reflowIndex);
+    auto row = (_reflowIndex == _paras.size() ?
+                _historyRows + _lostRows :
+                _paras[_reflowIndex].row);
+
+    while (_reflowIndex != end) {
+        --_reflowIndex;
+        auto & para = _paras[_reflowIndex];
+        row -= getLengthRows(para.length);
+        para.row = row;
+    }
+
+    ASSERT(_reflowIndex != 0 || _paras.empty() || _paras.front().row == _lostRows, "");
+}
+
+Buffer::HLine Buffer::getHLine(int32_t row) const {
+    ASSERT(row < 0 && static_cast<uint32_t>(-row) <= _historyRows, "row=" << row);
+
+    uint32_t rrow = _historyRows + row;     // Relative to the first paragraph.
+
+    while (_reflowIndex != 0 &&
+           (_reflowIndex == _paras.size() || rrow < _paras[_reflowIndex].row - _lostRows)) {
+        reflowParas(REFLOW_CHUNK);
+    }
+
+    // Find the last paragraph that starts at or before rrow.
+    auto iter = std::upper_bound(_paras.begin() + _reflowIndex, _paras.end(), rrow,
+                                 [this](uint32_t r, const HPara & para) {
+                                     return r < para.row - _lostRows;
+                                 });
+    ASSERT(iter != _paras.begin() + _reflowIndex, "");
+    --iter;
+
+    return HLine(iter - _paras.begin(), rrow - (iter->row - _lostRows));
+}
+
+uint32_t Buffer::getParaRows(size_t index) const {
+    ASSERT(index < _paras.size(), "");
+
+    if (index < _reflowIndex) {
+        return getLengthRows(_paras[index].length);
+    }
+
+    auto next = index + 1 == _paras.size() ? _historyRows + _lostRows : _paras[index + 1].row;
+    return next - _paras[index].row;
+}
+
+uint32_t Buffer::getLengthRows(uint32_t length) const {
+    // A paragraph occupies at least one row, even if it is empty.
+    return std::max<uint32_t>(1, (length + _cols - 1) / _cols);
+}
+
+size_t Buffer::getProvisionalIndex() const {
+    return _tags.size() - _provisional.size() - (_pending.empty() ? 0 : 1);
+}
+
+bool Buffer::getParaPos(size_t index, uint32_t offset, APos & pos) const {
+    int32_t row;
+
+    if (index < _tags.size()) {
+        while (_reflowIndex > index) {
+            reflowParas(REFLOW_CHUNK);
+        }
+
+        row = static_cast<int32_t>(_paras[index].row - _lostRows - _historyRows);
+    }
+    else {
+        // The pending paragraph, the last in _tags, continues into the active
+        // region. Skip its lines, then those of the preceding active paragraphs.
+        auto skip = index - _tags.size() + (_pending.empty() ? 0 : 1);
+        row = 0;
+
+        for (; skip != 0 && row < getRows(); --skip) {
+            while (row < getRows() && _active[row].cont) {
+                ++row;
+            }
+
+            ++row;
+        }
+
+        if (row >= getRows()) {
+            return false;
+        }
+    }
+
+    row += offset / _cols;
+    pos = APos(row, offset % _cols);
+
+    return row < getRows();
+}
+
+void Buffer::getPosPara(APos pos, size_t & index, uint32_t & offset) const {
+    if (pos.row < 0) {
+        auto hline = getHLine(pos.row);
+        index  = hline.index;
+        offset = hline.seqnum * _cols + pos.col;
+    }
+    else {
+        // The pending paragraph, the last in _tags, continues into the active
+        // region.
+        index  = _tags.size() - (_pending.empty() ? 0 : 1);
+        offset = _pending.size();
+
+        for (int16_t row = 0; row != pos.row; ++row) {
+            if (_active[row].cont) {
+                offset += _cols;
+            }
+            else {
+                ++index;
+                offset = 0;
+            }
+        }
+
+        offset += pos.col;
+    }
+}
+
+bool Buffer::scrollToPrompt(uint32_t prompt) {
+    APos pos;
+
+    if (!getParaPos(prompt - _lostParas, 0, pos)) {
+        // The paragraph has gone from the active region.
+        return false;
+    }
+
+    auto scrollOffset = std::min(static_cast<uint32_t>(std::max(-pos.row, 0)),
+                                 getHistoricalRows());
+
+    if (scrollOffset != _scrollOffset) {
+        _scrollOffset = scrollOffset;
+        damageViewport(true);
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+void Buffer::trimPrompts() {
+    while (!_prompts.empty() && _prompts.front() < _lostParas) {
+        _prompts.pop_front();
+    }
+}
+
+const std::vector<Cell> & Buffer::getPara(size_t index) const {
+    auto tag = _tags[index];
 
-        ++index;
+    if (LIKELY(tag != I_Deduper::invalidTag())) {
+        return lookupPara(tag);
     }
 
-    _history.shrink_to_fit();
+    auto offset = index - getProvisionalIndex();
+
+    if (offset < _provisional.size()) {
+        return _provisional[offset];
+    }
+    else {
+        ASSERT(index == _tags.size() - 1 && !_pending.empty(), "");
+        return _pending;
+    }
+}
+
+void Buffer::ingestPara(std::vector<Cell> && cells) {
+    if (!_ingester) {
+        _ingester = new Ingester(_deduper);
+    }
+
+    // Elements of a deque stay put as it grows, so the Ingester can read
+    // this one in place.
+    _provisional.push_back(std::move(cells));
+    ASSERT(cells.empty(), "Not stolen by move constructor?");
+    _ingester->submit(_provisional.back());
+}
+
+void Buffer::resolveParas(size_t backlog) {
+    if (!_ingester) {
+        return;
+    }
+
+    std::vector<I_Deduper::Tag> tags;
+    _ingester->collect(tags, backlog);
+
+    auto index = getProvisionalIndex();
+
+    for (auto tag : tags) {
+        ASSERT(tag != I_Deduper::invalidTag(), "");
+        ASSERT(_tags[index] == I_Deduper::invalidTag(), "");
+        _tags[index++] = tag;
+        _provisional.pop_front();
+    }
+}
+
+const std::vector<Cell> & Buffer::lookupPara(I_Deduper::Tag tag) const {
+    auto iter = _paraCache.find(tag);
+
+    if (iter != _paraCache.end()) {
+        ++_paraCacheHits;
+        return iter->second;
+    }
+
+    if (_prefetcher) {
+        std::vector<Prefetcher::Para> paras;
+        _prefetcher->collect(paras);
+
+        for (auto & para : paras) {
+            if (_paraCache.count(para.tag) == 0) {
+                cachePara(para.tag, std::move(para.cells));
+            }
+        }
+
+        iter = _paraCache.find(tag);
+
+        if (iter != _paraCache.end()) {
+            ++_paraCacheHits;
+            return iter->second;
+        }
+    }
+
+    ++_paraCacheMisses;
+
+    std::vector<Cell> cells;
+    _deduper.lookup(tag, cells);
+    cachePara(tag, std::move(cells));
+
+    return _paraCache.find(tag)->second;
+}
+
+void Buffer::cachePara(I_Deduper::Tag tag, std::vector<Cell> && cells) const {
+    _paraCacheCells += cells.size();
+    _paraCache.insert(tag, std::move(cells));
+
+    // Evict the least recently used paragraphs, but not the one just added.
+    while (_paraCache.size() > 1 &&
+           (_paraCache.size() > PARA_CACHE_PARAS || _paraCacheCells > PARA_CACHE_CELLS))
+    {
+        auto oldest = _paraCache.begin();
+        _paraCacheCells -= oldest->second.size();
+        _paraCache.erase(oldest);
+    }
+}
+
+void Buffer::uncachePara(I_Deduper::Tag tag) {
+    if (_prefetcher) {
+        // The prefetch request may include the tag.
+        _prefetcher->forget(tag);
+    }
+
+    // The deduper may reuse the tag once it is released, so forget it.
+    auto iter = _paraCache.find(tag);
+
+    if (iter != _paraCache.end()) {
+        _paraCacheCells -= iter->second.size();
+        _paraCache.erase(iter);
+    }
+
+    auto hiter = _hspanCache.find(tag);
+
+    if (hiter != _hspanCache.end()) {
+        _hspanCache.erase(hiter);
+    }
+}
+
+void Buffer::prefetchHistory(int16_t direction) {
+    if (!_prefetcher) {
+        _prefetcher = new Prefetcher(_deduper);
+    }
+    else if (direction != _scrollDirection) {
+        // Drop anything decoded for the other direction.
+        _prefetcher->cancel();
+    }
+
+    _scrollDirection = direction;
+
+    // The range of rows [begin, end) that would be exposed next, in APos terms.
+    int32_t top = -static_cast<int32_t>(_scrollOffset);
+    int32_t begin, end;
+
+    if (direction > 0) {
+        begin = std::max(top - PREFETCH_PAGES * getRows(), -static_cast<int32_t>(_historyRows));
+        end   = top;
+    }
+    else {
+        begin = top + getRows();
+        end   = std::min(begin + PREFETCH_PAGES * getRows(), 0);
+    }
+
+    std::vector<I_Deduper::Tag> tags;
+    auto last = I_Deduper::invalidTag();
+
+    // Request the paragraphs in the order they will be exposed.
+    for (int32_t i = 0; i < end - begin; ++i) {
+        auto row = direction > 0 ? end - 1 - i : begin + i;
+        auto tag = _tags[getHLine(row).index];
+
+        if (tag != last && tag != I_Deduper::invalidTag() && _paraCache.count(tag) == 0) {
+            tags.push_back(tag);
+        }
+
+        last = tag;
+    }
+
+    _prefetcher->request(std::move(tags));
+}
+
+void Buffer::releaseTags() {
+    _deduper.removeBatch(_released.data(), _released.size());
+    _released.clear();
+}
+
+void Buffer::addLength(uint32_t length) {
+    ++_lengths[length];
+    _historyCells += length;
+}
+
+void Buffer::removeLength(uint32_t length) {
+    auto iter = _lengths.find(length);
+    ASSERT(iter != _lengths.end(), "");
+    _historyCells -= length;
+
+    if (--iter->second == 0) {
+        _lengths.erase(iter);
+    }
 }
 
 bool Buffer::isCellSelected(APos apos, APos begin, APos end, int16_t wrap) {
@@ -1614,6 +2752,26 @@ bool Buffer::isCellSelected(APos apos, APos begin, APos end, int16_t wrap) {
     }
 }
 
+void Buffer::getSelectedCols(int32_t row, APos begin, APos end, int16_t wrap, int16_t cols,
+                             int16_t & col0, int16_t & col1) {
+    // This is isCellSelected() for a whole row.
+    col0 = col1 = 0;
+
+    if (row >= begin.row && row <= end.row) {
+        if (row == begin.row) {
+            if (begin.col >= wrap) { return; }
+            col0 = begin.col;
+        }
+
+        if (row == end.row && end.col <= wrap) {
+            col1 = std::max(col0, end.col);
+        }
+        else {
+            col1 = cols;
+        }
+    }
+}
+
 void Buffer::testClearSelection(APos begin, APos end) {
     APos selBegin, selEnd;
     if (normaliseSelection(selBegin, selEnd)) {
@@ -1661,7 +2819,12 @@ void Buffer::insertLinesAt(int16_t row, uint16_t n) {
     _active.erase (_active.begin() + _marginEnd - n, _active.begin() + _marginEnd);
     _active.insert(_active.begin() + row, n, ALine(getCols(), _cursor.style));
 
-    damageRows(row, _marginEnd);
+    if (_scrollOffset == 0 && n != 0) {
+        damageMove(row, _marginEnd, -static_cast<int16_t>(n));
+    }
+    else {
+        damageRows(row, _marginEnd);
+    }
 
     // We mustn't leave a line with 'cont' set when the continuation line
     // is gone. This can also cause _active.back().cont to be true, violating
@@ -1694,7 +2857,12 @@ void Buffer::eraseLinesAt(int16_t row, uint16_t n) {
     _active.erase (_active.begin() + row, _active.begin() + row + n);
     _active.insert(_active.begin() + _marginEnd - n, n, ALine(getCols(), _cursor.style));
 
-    damageRows(row, _marginEnd);
+    if (_scrollOffset == 0 && n != 0) {
+        damageMove(row, _marginEnd, static_cast<int16_t>(n));
+    }
+    else {
+        damageRows(row, _marginEnd);
+    }
 
     ASSERT(!_active.back().cont, "");
 }
@@ -1730,7 +2898,7 @@ void Buffer::damageRows(int16_t begin, int16_t end) {
         auto damageRow = _scrollOffset + static_cast<uint32_t>(i);
 
         if (damageRow < static_cast<uint32_t>(getRows())) {
-            _damage[i].damageSet(0, getCols());
+            _damage[damageRow].damageSet(0, getCols());
         }
         else {
             break;
@@ -1738,6 +2906,72 @@ void Buffer::damageRows(int16_t begin, int16_t end) {
     }
 }
 
+void Buffer::damageMove(int16_t begin, int16_t end, int16_t rows) {
+    ASSERT(begin < end, "");
+    ASSERT(rows != 0, "");
+
+    // The cursor's pixels are moved with the rest.
+    damageCell();
+
+    if (_move.rows != 0 && (_move.begin != begin || _move.end != end)) {
+        // Only a single region may be moved per dispatch.
+        cancelMove();
+    }
+
+    auto total = _move.rows + rows;
+
+    if (_search || total >= end - begin || -total >= end - begin) {
+        // Either the search bar would be moved or there would be
+        // nothing left to move.
+        cancelMove();
+
+        for (auto i = begin; i != end; ++i) {
+            _damage[i].damageSet(0, getCols());
+        }
+
+        return;
+    }
+
+    // The damage and snapshot move with the pixels. The exposed rows are damaged.
+    if (rows > 0) {
+        std::move(_damage.begin() + begin + rows, _damage.begin() + end, _damage.begin() + begin);
+        std::move(_snapshot.begin() + begin + rows, _snapshot.begin() + end, _snapshot.begin() + begin);
+
+        for (auto i = end - rows; i != end; ++i) {
+            _damage[i].damageSet(0, getCols());
+            _snapshot[i] = 0;
+        }
+    }
+    else {
+        std::move_backward(_damage.begin() + begin, _damage.begin() + end + rows, _damage.begin() + end);
+        std::move_backward(_snapshot.begin() + begin, _snapshot.begin() + end + rows, _snapshot.begin() + end);
+
+        for (auto i = begin; i != begin - rows; ++i) {
+            _damage[i].damageSet(0, getCols());
+            _snapshot[i] = 0;
+        }
+    }
+
+    _move.begin = begin;
+    _move.end   = end;
+    _move.rows  = total;
+
+    // The cursor will be drawn at its position, which didn't move with the pixels.
+    damageCell();
+}
+
+void Buffer::cancelMove() {
+    if (_move.rows != 0) {
+        // The damage and snapshot anticipated the move, so redraw the rows.
+        for (auto i = _move.begin; i != _move.end; ++i) {
+            _damage[i].damageSet(0, getCols());
+            _snapshot[i] = 0;
+        }
+
+        _move.reset();
+    }
+}
+
 void Buffer::damageSelection() {
     APos begin, end;
 
@@ -1758,11 +2992,85 @@ void Buffer::damageSelection() {
     }
 }
 
+void Buffer::damageSelectionChange(bool oldValid, APos oldBegin, APos oldEnd) {
+    APos newBegin, newEnd;
+    auto newValid = normaliseSelection(newBegin, newEnd);
+
+    if (!oldValid && !newValid) {
+        return;
+    }
+
+    // The rows of either selection, viewport relative and clamped.
+    auto offset = static_cast<int32_t>(_scrollOffset);
+    auto first  = std::numeric_limits<int32_t>::max();
+    auto last   = std::numeric_limits<int32_t>::min();
+
+    if (oldValid) {
+        first = std::min(first, oldBegin.row);
+        last  = std::max(last,  oldEnd.row);
+    }
+
+    if (newValid) {
+        first = std::min(first, newBegin.row);
+        last  = std::max(last,  newEnd.row);
+    }
+
+    auto row0 = std::max<int32_t>(first + offset, 0);
+    auto row1 = std::min<int32_t>(last + 1 + offset, getRows());
+
+    for (auto i = row0; i < row1; ++i) {
+        auto row = i - offset;
+
+        // Only the first and last rows of a selection depend on the wrap.
+        // A row beyond the history has none to depend on.
+        int16_t wrap = getCols();
+
+        if (row >= -static_cast<int32_t>(_historyRows) &&
+            ((oldValid && (row == oldBegin.row || row == oldEnd.row)) ||
+             (newValid && (row == newBegin.row || row == newEnd.row))))
+        {
+            wrap = getWrap(row);
+        }
+
+        int16_t old0 = 0, old1 = 0, new0 = 0, new1 = 0;
+
+        if (oldValid) {
+            getSelectedCols(row, oldBegin, oldEnd, wrap, getCols(), old0, old1);
+        }
+
+        if (newValid) {
+            getSelectedCols(row, newBegin, newEnd, wrap, getCols(), new0, new1);
+        }
+
+        // Damage the span of the columns that changed.
+        int16_t col0, col1;
+
+        if (old0 == old1) {
+            col0 = new0;
+            col1 = new1;
+        }
+        else if (new0 == new1) {
+            col0 = old0;
+            col1 = old1;
+        }
+        else {
+            col0 = old0 != new0 ? std::min(old0, new0) : std::min(old1, new1);
+            col1 = old1 != new1 ? std::max(old1, new1) : std::max(old0, new0);
+        }
+
+        if (col0 < col1) {
+            _damage[i].damageAdd(col0, col1);
+        }
+    }
+}
+
 void Buffer::addLine() {
     if (marginsSet()) {
         eraseLinesAt(_marginBegin, 1);
     }
     else {
+        auto oldScrollOffset = _scrollOffset;
+
         if (_historyLimit == 0) {
             _active.pop_front();
         }
@@ -1770,19 +3078,19 @@ void Buffer::addLine() {
             bump();
 
             if (!_config.scrollWithHistory) {
-                if (_scrollOffset != 0 && _scrollOffset != _history.size()) {
+                if (_scrollOffset != 0 && _scrollOffset != _historyRows) {
                     ++_scrollOffset;
                 }
             }
 
-            enforceHistoryLimit();
+            enforceHistoryLimit(_historyLimit);
         }
 
         _active.emplace_back(getCols());
 
         APos begin, end;
         if (normaliseSelection(begin, end)) {
-            if (begin.row == -static_cast<int32_t>(_history.size())) {
+            if (begin.row == -static_cast<int32_t>(_historyRows)) {
                 clearSelection();
             }
             else {
@@ -1791,13 +3099,20 @@ void Buffer::addLine() {
             }
         }
         else {
-            if (_selectMark.row > -static_cast<int32_t>(_history.size())) {
+            if (_selectMark.row > -static_cast<int32_t>(_historyRows)) {
                 --_selectMark.row;
                 --_selectDelim.row;
             }
         }
 
-        damageViewport(true);
+        if (oldScrollOffset == 0 && _scrollOffset == 0) {
+            // The viewport shows the bottom of the buffer, which moved up a row.
+            damageMove(0, getRows(), 1);
+            _barDamage = true;
+        }
+        else {
+            damageViewport(true);
+        }
     }
 }
 
@@ -1815,8 +3130,10 @@ void Buffer::bump() {
 
     if (_pending.empty()) {
         // This line is not a continuation of a previous line.
-        ASSERT(_tags.empty() || _tags.back() != I_Deduper::invalidTag(), "");
-        ASSERT(_history.empty() || _history.back().index - _lostTags == _tags.size() - 1, "");
+        ASSERT(_tags.empty() || _tags.back() != I_Deduper::invalidTag() || !_provisional.empty(), "");
+        ASSERT(_paras.size() == _tags.size(), "");
+
+        uint32_t length;
 
         if (cont) {
             // This line is continued on the next line so it can't be stored
@@ -1824,64 +3141,82 @@ void Buffer::bump() {
             _pending = std::move(cells);
             ASSERT(cells.empty(), "Not stolen by move constructor?");
             _tags.push_back(I_Deduper::invalidTag());
+            length = _pending.size();
         }
         else {
             // This line is completely standalone. Immediately dedupe it.
             ASSERT(static_cast<size_t>(wrap) <= cells.size(), "");
             cells.erase(cells.begin() + wrap, cells.end());
-            auto tag = _deduper.store(cells);
-            ASSERT(tag != I_Deduper::invalidTag(), "");
-            _tags.push_back(tag);
+            _tags.push_back(I_Deduper::invalidTag());
+            length = cells.size();
+            addLength(length);
+            ingestPara(std::move(cells));
         }
 
-        _history.push_back(HLine(_tags.size() + _lostTags - 1, 0));
+        _paras.push_back(HPara(length, _historyRows + _lostRows));
+        ++_historyRows;
     }
     else {
         // This line is a continuation of the previous line.
         // Copy its contents into _pending.
         ASSERT(!_tags.empty(), "");
         ASSERT(_tags.back() == I_Deduper::invalidTag(), "");
-        ASSERT(!_history.empty(), "");
-        ASSERT(_history.back().index - _lostTags == _tags.size() - 1, "");
+        ASSERT(_paras.size() == _tags.size(), "");
         auto oldSize = _pending.size();
         ASSERT(oldSize % _cols == 0, "");
 
         _pending.resize(oldSize + wrap, Cell::blank());
         std::copy(cells.begin(), cells.begin() + wrap, _pending.begin() + oldSize);
-        _history.push_back(HLine(_tags.size() + _lostTags - 1, _history.back().seqnum + 1));
+        _paras.back().length = _pending.size();
+        ++_historyRows;
 
         if (!cont) {
             // This line is not itself continued.
-            // Store _pending and the tag.
-            auto tag = _deduper.store(_pending);
-            ASSERT(tag != I_Deduper::invalidTag(), "");
+            // Store _pending, the tag follows.
+            addLength(_pending.size());
+            ingestPara(std::move(_pending));
             _pending.clear();
-            ASSERT(_tags.back() == I_Deduper::invalidTag(), "");
-            _tags.back() = tag;
         }
     }
 
-    ASSERT(!_history.empty() && _history.back().index - _lostTags == _tags.size() - 1, "");
+    ASSERT(_paras.size() == _tags.size(), "");
+
+    // Pick up the tags stored so far, waiting if the Ingester has fallen
+    // too far behind.
+    resolveParas(INGEST_BACKLOG);
 
     _active.pop_front();        // This invalidates 'aline'.
+
+    // Make progress with any lazy reflow while history is being added.
+    if (_reflowIndex != 0) {
+        reflowParas(REFLOW_CHUNK);
+    }
 }
 
 void Buffer::unbump() {
     ASSERT(!_tags.empty(), "");
-    ASSERT(!_history.empty(), "");
+    ASSERT(_paras.size() == _tags.size(), "");
 
-    auto & hline = _history.back();
-    ASSERT(hline.index - _lostTags == _tags.size() - 1, "");
+    auto hline = getHLine(-1);
+    ASSERT(hline.index == _tags.size() - 1, "");
 
     bool cont;
 
     if (_pending.empty()) {
         cont = false;
+
+        if (!_provisional.empty()) {
+            // The last paragraph is provisional.
+            resolveParas(0);
+        }
+
         auto tag = _tags.back();
         ASSERT(tag != I_Deduper::invalidTag(), "");
         _deduper.lookup(tag, _pending);
+        uncachePara(tag);
         _deduper.remove(tag);
         _tags.back() = I_Deduper::invalidTag();
+        removeLength(_paras.back().length);
     }
     else {
         cont = true;
@@ -1897,29 +3232,53 @@ void Buffer::unbump() {
     ASSERT(cells.empty(), "Not stolen by move constructor?");
     ASSERT(_active.front().wrap <= _cols, "");
 
-    _history.pop_back();
+    --_historyRows;
 
-    if (_history.empty() || _history.back().index - _lostTags != _tags.size() - 1) {
+    if (hline.seqnum == 0) {
         _tags.pop_back();
+        _paras.pop_back();
+        _reflowIndex = std::min(_reflowIndex, _paras.size());
         ASSERT(_pending.empty(), "");
     }
+    else {
+        _paras.back().length = _pending.size();
+    }
 }
 
-void Buffer::enforceHistoryLimit() {
-    while (_tags.size() > _historyLimit) {
-        while (!_history.empty() && _history.front().index == _lostTags) {
-            if (_scrollOffset == _history.size()) { --_scrollOffset; }
-            _history.pop_front();
+void Buffer::enforceHistoryLimit(size_t limit) {
+    while (_tags.size() > limit) {
+        if (!_provisional.empty() && getProvisionalIndex() == 0) {
+            // Wait for the first paragraph to be stored.
+            resolveParas(_provisional.size() - 1);
+        }
+
+        auto rows = getParaRows(0);
+        _historyRows -= rows;
+        _lostRows    += rows;
+        _scrollOffset = std::min(_scrollOffset, _historyRows);
+
+        if (_tags.front() != I_Deduper::invalidTag()) {
+            removeLength(_paras.front().length);
+            uncachePara(_tags.front());
+            _released.push_back(_tags.front());
         }
 
-        _deduper.remove(_tags.front());
         _tags.pop_front();
-        ++_lostTags;
+        _paras.pop_front();
+        ++_lostParas;
+
+        if (_reflowIndex != 0) { --_reflowIndex; }
+    }
+
+    trimPrompts();
+
+    if (_released.size() >= RELEASE_BATCH) {
+        releaseTags();
     }
 
     APos begin, end;
     if (normaliseSelection(begin, end)) {
-        if (static_cast<int32_t>(_history.size()) + begin.row < 0) {
+        if (static_cast<int32_t>(_historyRows) + begin.row < 0) {
             clearSelection();
         }
     }
@@ -8,11 +8,19 @@
 #include "terminol/common/config.hxx"
 #include "terminol/common/deduper_interface.hxx"
 #include "terminol/common/char_sub.hxx"
+#include "terminol/common/ingester.hxx"
+#include "terminol/common/prefetcher.hxx"
+#include "terminol/common/searcher.hxx"
+#include "terminol/common/selected_text.hxx"
 #include "terminol/support/async_destroyer.hxx"
+#include "terminol/support/cache.hxx"
 #include "terminol/support/regex.hxx"
 
 #include <deque>
+#include <limits>
+#include <unordered_map>
 #include <vector>
+#include <memory>
 #include <iomanip>
 
 // Buffer is the in-memory representation of the on-screen terminal data.
@@ -39,11 +47,15 @@
 // data is stored as paragraphs, e.g. if some text is continued across three
 // lines then the concatenation of those three lines is stored in the
 // historical data.
-// An additional data structure, HLine, allows historical data to be indexed
-// (by row/column) by mapping the grid into segments of these paragraphs.
+// An additional data structure, HPara, caches the length of each paragraph
+// and the cumulative count of rows that precede it. This allows historical
+// data to be indexed (by row/column) by binary searching for the paragraph
+// containing a row, without storing anything per row.
 //
-// During a reflowed-resize the HLines are invalidated but the paragraphs
-// are not. The HLines must be rebuilt by re-traversing the paragraphs.
+// During a reflowed-resize the row counts are invalidated but the paragraphs
+// are not. The total is recomputed at once from a count of the paragraphs
+// of each length, and the HParas are recomputed lazily from their cached
+// lengths, most recent first, so the viewport is available immediately.
 // Because the paragraphs are never invalidated (not even during resize)
 // they are stored in a deduplicator object to reduce memory usage for large
 // histories.
@@ -82,13 +94,48 @@ class Buffer {
 
     // HLine (or Historical-Line) represents a line of text in the historical region.
     // It can also be thought of as representing a segment of an unwrapped line.
+    // HLines are not stored, they are computed from the HParas by getHLine().
     struct HLine {
-        uint32_t index;             // index into _tags (adjusted by _lostTags)
+        uint32_t index;             // index into _tags
         uint32_t seqnum;            // continuation number, 0 -> 1st line, 1 -> 2nd line, etc
 
         HLine(uint32_t index_, uint32_t seqnum_) : index(index_), seqnum(seqnum_) {}
     };
 
+    // HPara (or Historical-Paragraph) caches the layout of the corresponding
+    // paragraph in _tags.
+    struct HPara {
+        uint32_t length;            // number of cells, valid unless the paragraph is pending
+        uint32_t row;               // row of the first segment (adjusted by _lostRows)
+
+        HPara(uint32_t length_, uint32_t row_) : length(length_), row(row_) {}
+    };
+
+    // HSpan (or Highlight-Span) is a match of a user pattern (Config::highlights)
+    // within a paragraph or line.
+    struct HSpan {
+        uint32_t begin;             // Cell offset of the first matched cell.
+        uint32_t end;               // Cell offset beyond the last matched cell.
+        UColor   fg;
+
+        HSpan(uint32_t begin_, uint32_t end_, UColor fg_) :
+            begin(begin_), end(end_), fg(fg_) {}
+    };
+
+    // HMemo holds the highlights of the unstored paragraph that a dispatch
+    // highlighted last, for its other lines.
+    struct HMemo {
+        HMemo() : index(std::numeric_limits<size_t>::max()), hspans() {}
+
+        size_t             index;   // Paragraph, as numbered by highlightLine().
+        std::vector<HSpan> hspans;
+    };
+
+    typedef std::unordered_map<uint32_t, uint32_t>    LengthCounts;
+    typedef Cache<I_Deduper::Tag, std::vector<Cell>>  ParaCache;
+    typedef std::deque<std::vector<Cell>>             ParaQueue;
+    typedef Cache<I_Deduper::Tag, std::vector<HSpan>> HSpanCache;
+
     // ALine (or Active-Line) represents a line of text in the active region.
     // An ALine directly contains its cells
     struct ALine {
@@ -165,6 +212,21 @@ class Buffer {
         }
     };
 
+    // A pending move of a region of viewport rows. The renderer can move
+    // the pixels (e.g. blit) rather than redraw every row.
+    struct Move {
+        int16_t begin;      // inclusive
+        int16_t end;        // exclusive
+        int16_t rows;       // > 0 -> up, < 0 -> down, 0 -> no move pending
+
+        Move() : begin(0), end(0), rows(0) {}
+
+        // Reset to initial state.
+        void reset() {
+            *this = Move();
+        }
+    };
+
     // Cursor encompasses the state associated with a VT cursor.
     struct Cursor {
         Pos     pos;            // Current cursor position.
@@ -186,26 +248,43 @@ class Buffer {
     //
     //
 
-    class ParaIter {
-        const Buffer &    _buffer;
-        APos              _pos;
-        std::vector<Cell> _cells;
-        bool              _cont;
-        int16_t           _wrap;
+    // ParaCursor walks the cells of a whole paragraph, which may span the
+    // historical and active regions. The paragraph is fetched once, up front.
+    class ParaCursor {
+        std::vector<Cell> _cells;   // The concatenated segments of the paragraph.
+        int32_t           _row;     // Row of the first segment.
+        int16_t           _cols;
+        uint32_t          _offset;  // Index into _cells.
         bool              _valid;
 
     public:
-        ParaIter(const Buffer & buffer, APos pos);
+        ParaCursor(const Buffer & buffer, APos pos);
 
         bool valid() const { return _valid; }
 
-        const APos & getPos() const { return _pos; }
+        APos getPos() const { return APos(_row + _offset / _cols, _offset % _cols); }
 
-        const Cell & getCell() const { return _cells[_pos.col]; }
+        const Cell & getCell() const { return _cells[_offset]; }
 
-        void moveForward();
+        const std::vector<Cell> & getCells() const { return _cells; }
 
-        void moveBackward();
+        uint32_t getOffset() const { return _offset; }
+
+        void setOffset(uint32_t offset) {
+            _offset = offset;
+            _valid  = _offset < _cells.size();
+        }
+
+        void moveForward() {
+            ASSERT(_valid, "Invalid");
+            setOffset(_offset + 1);
+        }
+
+        void moveBackward() {
+            ASSERT(_valid, "Invalid");
+            if (_offset == 0) { _valid = false; }
+            else              { --_offset; }
+        }
     };
 
     //
@@ -220,9 +299,9 @@ class Buffer {
     public:
         BufferIter(const Buffer & buffer, int32_t row);
 
-        ParaIter getParaIter() const {
+        ParaCursor getParaCursor() const {
             ASSERT(_valid, "Invalid.");
-            return ParaIter(_buffer, APos(_row, 0));
+            return ParaCursor(_buffer, APos(_row, 0));
         }
 
         bool valid() const {
@@ -242,13 +321,24 @@ class Buffer {
     //
 
     struct Search {
-        Search(const Buffer & buffer, const std::string & pattern_) :
-            iter(buffer, buffer.getRows() - 2),
-            pattern(pattern_) {}
-
-        BufferIter                              iter;
-        std::string                             pattern;
-        std::vector<std::vector<Regex::Substr>> allOffsets;
+        explicit Search(const std::string & pattern_) :
+            pattern(pattern_),
+            valid(true),
+            running(false),
+            tags(),
+            paras(),
+            lostParas(0),
+            matches(),
+            current(0) {}
+
+        std::string                  pattern;
+        bool                         valid;     // Did the pattern compile?
+        bool                         running;   // Is the Searcher still going?
+        Searcher::Tags               tags;      // Snapshot of the history, retained. Null
+        Searcher::Paras              paras;     // until taken by the first pattern.
+        uint32_t                     lostParas; // _lostParas when the snapshot was taken.
+        std::vector<Searcher::Match> matches;   // Most recent first.
+        size_t                       current;   // Index into matches of the selected match.
     };
 
     //
@@ -259,11 +349,31 @@ class Buffer {
     I_Deduper                  & _deduper;
     I_Destroyer                & _destroyer;
     std::deque<I_Deduper::Tag>   _tags;             // The paragraph history.
-    uint32_t                     _lostTags;         // Incremented for each _tags.pop_front().
+    mutable std::deque<HPara>    _paras;            // Parallel to _tags.
+    mutable size_t               _reflowIndex;      // _paras before this index have stale rows.
+    LengthCounts                 _lengths;          // Number of stored paragraphs of each length.
+    size_t                       _historyCells;     // Total length of the stored paragraphs.
+    uint32_t                     _lostRows;         // Incremented for each row of _paras.pop_front().
+    uint32_t                     _lostParas;        // Incremented for each _paras.pop_front().
+    std::deque<uint32_t>         _prompts;          // Paragraphs (plus _lostParas) of prompt marks, ascending.
+    uint32_t                     _historyRows;      // Number of historical paragraph segments.
     std::vector<Cell>            _pending;          // Paragraph pending to become historical.
-    std::deque<HLine>            _history;          // Historical paragraph segments. Indexable.
+    ParaQueue                    _provisional;      // Stored paragraphs awaiting their tags.
+    Ingester                   * _ingester;         // Created by the first stored paragraph.
+    std::vector<I_Deduper::Tag>  _released;         // Tags awaiting removal, see releaseTags().
+    mutable ParaCache            _paraCache;        // Decoded stored paragraphs, by tag.
+    mutable size_t               _paraCacheCells;   // Total cells in _paraCache.
+    mutable uint32_t             _paraCacheHits;
+    mutable uint32_t             _paraCacheMisses;
+    std::vector<Regex *>         _highlighters;     // Parallel to _config.highlights.
+    mutable HSpanCache           _hspanCache;       // Highlights of stored paragraphs, by tag.
+    Prefetcher                 * _prefetcher;       // Created by the first scroll into history.
+    int16_t                      _scrollDirection;  // Of the last scroll: 1 -> up, -1 -> down.
     std::deque<ALine>            _active;           // Active paragraph segments. Indexable.
+    std::vector<I_Deduper::Tag>  _frozen;           // Parallel to _active while hibernating.
     std::vector<Damage>          _damage;           // Viewport-relative damage.
+    std::vector<uint64_t>        _snapshot;         // Viewport-relative hash of last dispatch, 0 -> unknown.
+    Move                         _move;             // Viewport-relative move, prior to _damage.
     std::vector<bool>            _tabs;             // Column-indexable, true if tab stop exists.
     uint32_t                     _scrollOffset;     // 0 -> scroll bottom
     uint32_t                     _historyLimit;     // Maximum number of historical paragraphs to keep.
@@ -277,6 +387,9 @@ class Buffer {
     SavedCursor                  _savedCursor;      // Saved cursor.
     CharSubArray                 _charSubs;
     Search                     * _search;
+    Searcher                   * _searcher;         // Created by the first search.
+    uint32_t                     _dispatchedRows;   // Damaged rows that were drawn.
+    uint32_t                     _skippedRows;      // Damaged rows that matched _snapshot.
 
 public:
     class I_Renderer {
@@ -297,6 +410,11 @@ public:
                                       const uint8_t * str,    // nul-terminated, count 1
                                       size_t          size,
                                       bool            wrapNext) = 0;
+        // Move the rows [begin, end) up by 'rows' (down if negative).
+        // Return false if unable, in which case the rows are redrawn.
+        virtual bool bufferMoveRows(int16_t begin,
+                                    int16_t end,
+                                    int16_t rows) = 0;
 
     protected:
         ~I_Renderer() {}
@@ -317,11 +435,13 @@ public:
     int16_t  getCols() const { return _cols; }
 
     // How many _wrapped_ lines are there in the scroll-back history?
-    uint32_t getHistoricalRows() const { return _history.size(); }
+    uint32_t getHistoricalRows() const { return _historyRows; }
+    // How many cells are there in the stored paragraphs of the history?
+    size_t   getHistoryCells() const { return _historyCells; }
     // How many historical and active lines are there?
-    uint32_t getTotalRows() const { return _history.size() + _active.size(); }
+    uint32_t getTotalRows() const { return _historyRows + _active.size(); }
     // How many rows is viewport offset from the start of history?
-    uint32_t getHistoryOffset() const { return _history.size() - _scrollOffset; }
+    uint32_t getHistoryOffset() const { return _historyRows - _scrollOffset; }
     // How many rows is the viewport offset from the beginning of active?
     uint32_t getScrollOffset() const { return _scrollOffset; }
     // Is the bar damaged (does it need redrawing)?
@@ -332,8 +452,40 @@ public:
     void expandSelection(Pos pos, int level);
     void clearSelection();
     bool getSelectedText(std::string & text) const;
+    // Get a snapshot of the selection, to be read a piece at a time, or null
+    // if there is no selection.
+    std::shared_ptr<SelectedText> copySelection();
 
     void clearHistory();
+    // Discard the oldest paragraphs holding at least 'cells' cells, if there are that many.
+    void trimHistory(size_t cells);
+    // Get the whole history, including the active region as paragraphs: the
+    // stored paragraphs by tag, followed by the rest.
+    void getHistory(std::vector<I_Deduper::Tag>    & tags,
+                    std::vector<std::vector<Cell>> & paras) const;
+    // As above, but only the stored paragraphs from 'since' on, numbering
+    // them from the first ever added to the history. 'lost' takes the number
+    // of the oldest remaining paragraph. Returns the number following the
+    // stored paragraphs, the 'since' of a later call that wants only what
+    // has been added.
+    uint32_t getHistory(uint32_t                         since,
+                        uint32_t                       & lost,
+                        std::vector<I_Deduper::Tag>    & tags,
+                        std::vector<std::vector<Cell>> & paras) const;
+    // Start the (empty) history with these paragraphs, taking their references.
+    void restoreHistory(const std::vector<I_Deduper::Tag> & tags);
+
+    // Release what an idle buffer can do without: the cells of the active
+    // lines are stored in the deduper, and the caches and background threads
+    // are freed. Until thaw() only getRows(), getCols(), getHistory(),
+    // getHistoryCells(), isHibernating() and getResidentBytes() may be called.
+    void hibernate();
+    // Restore the active lines, damaging the viewport.
+    void thaw();
+    bool isHibernating() const { return !_frozen.empty(); }
+    // Approximately how many bytes does the buffer hold, not counting the
+    // deduper's entries?
+    size_t getResidentBytes() const;
 
     bool scrollUpHistory(uint16_t rows);
 
@@ -343,6 +495,15 @@ public:
 
     bool scrollBottomHistory();
 
+    // Note that the paragraph holding the cursor begins with a prompt.
+    void markPrompt();
+
+    // Scroll the first prompt above the top row to the top.
+    bool scrollPrevPrompt();
+
+    // Scroll the first prompt below the top row to the top.
+    bool scrollNextPrompt();
+
     Pos getCursorPos() const { return _cursor.pos; }
 
     void migrateFrom(Buffer & other, bool clear_);
@@ -438,6 +599,10 @@ public:
 
     void damageViewport(bool scrollbar);
 
+    // Forget what was last dispatched, e.g. because the renderer's
+    // surface was recreated or the cursor's appearance changed.
+    void resetSnapshot();
+
     void damageActive();
 
     void testPattern();
@@ -448,6 +613,9 @@ public:
 
     void dispatch(bool reverse, I_Renderer & renderer);
 
+    void getDispatchStats(uint32_t & dispatchedRows, uint32_t & skippedRows) const;
+    void getParaCacheStats(uint32_t & hits, uint32_t & misses) const;
+
     void useCharSet(CharSet charSet);
 
     void setCharSub(CharSet charSet, const CharSub * charSub);
@@ -458,8 +626,12 @@ public:
     void beginSearch(const std::string & pattern);
     const std::string & getSearchPattern() const;
     void setSearchPattern(const std::string & pattern);
-    void nextSearch();
-    void prevSearch();
+    bool isSearchRunning() const;
+    // Collect the matches found so far, selecting the first. Return true if
+    // the search bar needs redrawing.
+    bool updateSearch();
+    void nextSearch();      // Older match.
+    void prevSearch();      // Newer match.
     void endSearch();
 
     void dumpTags(std::ostream & ost) const;
@@ -470,16 +642,93 @@ public:
 protected:
     void getLine(int32_t row, std::vector<Cell> & cells,
                  bool & cont, int16_t & wrap) const;
-
-    void dispatchBg(bool reverse, I_Renderer & renderer) const;
-    void dispatchFg(bool reverse, I_Renderer & renderer) const;
+    // The wrap of a line, as from getLine(), without decoding it.
+    int16_t getWrap(int32_t row) const;
+
+    uint64_t hashRow(int16_t row, const std::vector<Cell> & cells,
+                     bool reverse, int16_t selCol0, int16_t selCol1) const;
+
+    void dispatchRows(bool reverse, I_Renderer & renderer);
+    // Overlay the colours of the user highlights onto the cells of a line,
+    // matching them over its whole paragraph. Stored paragraphs are matched
+    // once, others once per dispatch.
+    void highlightLine(int32_t row, std::vector<Cell> & cells, HMemo & memo) const;
+    void matchHighlights(const std::vector<Cell> & cells, size_t size,
+                         std::vector<HSpan> & hspans) const;
+    void dispatchBg(int16_t row, const std::vector<Cell> & cells,
+                    bool reverse, int16_t selCol0, int16_t selCol1,
+                    I_Renderer & renderer) const;
+    template <bool SWAP, bool CUSTOM>
+    void accumulateBg(int16_t row, const std::vector<Cell> & cells,
+                      int16_t begin, int16_t end, UColor custom,
+                      int16_t & col0, UColor & bg0,
+                      I_Renderer & renderer) const;
+    void dispatchFg(int16_t row, const std::vector<Cell> & cells,
+                    bool reverse, int16_t selCol0, int16_t selCol1,
+                    std::vector<uint8_t> & run, I_Renderer & renderer) const;
+    template <bool SWAP, bool CUSTOM>
+    void accumulateFg(int16_t row, const std::vector<Cell> & cells,
+                      int16_t begin, int16_t end, UColor custom,
+                      int16_t & col0, UColor & fg0, AttrSet & attrs0,
+                      std::vector<uint8_t> & run, I_Renderer & renderer) const;
     void dispatchCursor(bool reverse, I_Renderer & renderer) const;
     void dispatchSearch(bool reverse, I_Renderer & renderer) const;
+    std::string getSearchBar() const;
+    // Search the history for _search->pattern, replacing any previous
+    // results. The snapshot of the history is taken once, by the first
+    // pattern, and shared by the rest.
+    void startSearch();
+    // Cancel _searcher, if it is running.
+    void stopSearch();
+    // Stop the search and release its snapshot of the history.
+    void releaseSearchHistory();
+    // Select the current match and scroll it into view.
+    void showSearchMatch();
     void resetDamage();
 
-    void rebuildHistory();
+    // Invalidate the HPara rows after a change of _cols, and recompute the total.
+    void reflowHistory();
+    // Recompute the rows of up to 'count' more stale HParas, working backwards.
+    void reflowParas(size_t count) const;
+    // Map a historical row (< 0) to its paragraph and segment.
+    HLine getHLine(int32_t row) const;
+    uint32_t getParaRows(size_t index) const;
+    uint32_t getLengthRows(uint32_t length) const;
+    // Index into _tags of the first provisional paragraph.
+    size_t getProvisionalIndex() const;
+    // Map a cell offset within a paragraph, indexed as by getHistory(), to
+    // its position. Return false if the paragraph no longer exists.
+    bool getParaPos(size_t index, uint32_t offset, APos & pos) const;
+    // The inverse of getParaPos(), for a position that is in the history or
+    // active region.
+    void getPosPara(APos pos, size_t & index, uint32_t & offset) const;
+    // Scroll the prompt paragraph to the top, or as near as possible.
+    bool scrollToPrompt(uint32_t prompt);
+    // Forget the prompts of the paragraphs trimmed from the history.
+    void trimPrompts();
+    // Return the cells of any paragraph: pending, provisional or stored.
+    const std::vector<Cell> & getPara(size_t index) const;
+    // Hand a completed paragraph to _ingester, keeping a provisional copy.
+    void ingestPara(std::vector<Cell> && cells);
+    // Assign the tags stored so far to the provisional paragraphs, first
+    // waiting until no more than 'backlog' remain.
+    void resolveParas(size_t backlog);
+    // Remove the _released tags from the deduper in one batch.
+    void releaseTags();
+    // Return the cells of a stored paragraph, via _paraCache.
+    const std::vector<Cell> & lookupPara(I_Deduper::Tag tag) const;
+    void cachePara(I_Deduper::Tag tag, std::vector<Cell> && cells) const;
+    // Must be called before releasing a tag. Also forgets its highlights.
+    void uncachePara(I_Deduper::Tag tag);
+    // Decode, in the background, the paragraphs likely to be scrolled into view next.
+    void prefetchHistory(int16_t direction);
+    void addLength(uint32_t length);
+    void removeLength(uint32_t length);
 
     static bool isCellSelected(APos apos, APos begin, APos end, int16_t wrap);
+    // Return the selected columns of a row, [col0, col1), empty if col0 == col1.
+    static void getSelectedCols(int32_t row, APos begin, APos end, int16_t wrap, int16_t cols,
+                                int16_t & col0, int16_t & col1);
 
     void testClearSelection(APos begin, APos end);
 
@@ -495,15 +744,23 @@ protected:
 
     void damageRows(int16_t begin, int16_t end);
 
+    void damageMove(int16_t begin, int16_t end, int16_t rows);
+
+    void cancelMove();
+
     void damageSelection();
 
+    // Damage the cells whose selected state differs from the old selection,
+    // rather than whole rows of both.
+    void damageSelectionChange(bool oldValid, APos oldBegin, APos oldEnd);
+
     void addLine();
 
     void bump();
 
     void unbump();
 
-    void enforceHistoryLimit();
+    void enforceHistoryLimit(size_t limit);
 };
 
 #endif // COMMON__BUFFER__HXX
@@ -6,6 +6,9 @@
 
 #include "terminol/support/net.hxx"
 #include "terminol/common/config.hxx"
+#include "terminol/common/server.hxx"
+
+#include <cstring>
 
 class Client : protected SocketClient::I_Observer {
     SocketClient   _socket;
@@ -17,19 +20,40 @@ public:
         std::string message;
     };
 
+    // Ask the server to create a window, or to shut down.
     Client(I_Selector   & selector,
            const Config & config,
            bool           shutdown) try :
         _socket(*this, selector, config.socketPath),
         _finished(false)
     {
-        uint8_t byte = shutdown ? 0xFF : 0;
+        auto byte = static_cast<uint8_t>(shutdown ? Request::SHUTDOWN : Request::CREATE);
         _socket.send(&byte, 1);
     }
     catch (const SocketClient::Error & error) {
         throw Error(error.message);
     }
 
+    // Ask the server to export the history of 'window' to 'path'.
+    Client(I_Selector        & selector,
+           const Config      & config,
+           uint32_t            window,
+           const std::string & path,
+           bool                styles) try :
+        _socket(*this, selector, config.socketPath),
+        _finished(false)
+    {
+        std::vector<uint8_t> request(2 + sizeof window);
+        request[0] = static_cast<uint8_t>(Request::EXPORT);
+        request[1] = styles ? 1 : 0;
+        std::memcpy(&request[2], &window, sizeof window);
+        request.insert(request.end(), path.begin(), path.end());
+        _socket.send(&request.front(), request.size());
+    }
+    catch (const SocketClient::Error & error) {
+        throw Error(error.message);
+    }
+
     virtual ~Client() {}
 
     bool isFinished() const { return _finished; }
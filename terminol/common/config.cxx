@@ -180,8 +180,18 @@ Config::Config() :
     chdir(),
     scrollBackHistory(1 * 1024 * 1024),
     unlimitedScrollBack(true),
+    historyBudget(0),
+    historyPolicy(HistoryPolicy::LARGEST),
+    historyMemory(0),
+    historySpillDir("/var/tmp"),
+    historySnapshot(),
+    historyIndex(false),
+    historyExportDir("/tmp"),
+    historyExportStyles(false),
     framesPerSecond(50),
     traditionalWrapping(false),
+    altBufferReleaseDelay(60 * 1000),
+    hibernateDelay(10 * 60 * 1000),
     //
     traceTty(false),
     syncTty(false),
@@ -205,6 +215,7 @@ Config::Config() :
     serverFork(true),
     bindings(),
     cutChars("-A-Za-z0-9./?%&#_=+@~"),
+    highlights(),
     autoHideCursor(true),
     mapOnBell(false),
     urgentOnBell(false),
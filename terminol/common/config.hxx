@@ -9,6 +9,15 @@
 #include "terminol/common/data_types.hxx"
 #include "terminol/common/bindings.hxx"
 
+// Which windows lose history first when the history budget is exceeded.
+enum class HistoryPolicy { LARGEST, PROPORTIONAL };
+
+// Text matching a user defined pattern is drawn in its own colour.
+struct Highlight {
+    std::string pattern;
+    Color       fg;
+};
+
 struct Config {
     // titleUpdateStrategy: replace, append, prepend, ignore
 
@@ -25,8 +34,18 @@ struct Config {
     std::string chdir;
     size_t      scrollBackHistory;
     bool        unlimitedScrollBack;
+    size_t      historyBudget;          // Bytes of deduped history, 0 -> unlimited.
+    HistoryPolicy historyPolicy;
+    size_t      historyMemory;          // Bytes of history kept in memory, 0 -> unlimited.
+    std::string historySpillDir;        // Where history beyond historyMemory goes.
+    std::string historySnapshot;        // Server history file, empty -> none.
+    bool        historyIndex;           // Keep a trigram index for searching history.
+    std::string historyExportDir;       // Where the save-history action writes.
+    bool        historyExportStyles;    // Export with SGR escapes.
     int         framesPerSecond;
     bool        traditionalWrapping;
+    uint32_t    altBufferReleaseDelay;  // Milliseconds on the primary screen.
+    uint32_t    hibernateDelay;         // Milliseconds idle before hibernating, 0 -> never.
     // Debugging support:
     bool        traceTty;
     bool        syncTty;
@@ -66,6 +85,8 @@ struct Config {
 
     std::string cutChars;
 
+    std::vector<Highlight> highlights;  // Later highlights take precedence.
+
     bool        autoHideCursor;
 
     bool        mapOnBell;
@@ -7,6 +7,7 @@
 #include "terminol/common/data_types.hxx"
 
 #include <vector>
+#include <string>
 #include <numeric>
 
 class I_Deduper {
@@ -15,14 +16,48 @@ public:
     static Tag invalidTag() { return std::numeric_limits<Tag>::max(); }
 
     virtual Tag store(const std::vector<Cell> & cells) = 0;
+    // Store 'count' paragraphs at once, writing their tags to 'tags'.
+    virtual void storeBatch(const std::vector<Cell> * const * cells, size_t count,
+                            Tag * tags) = 0;
     virtual void lookup(Tag tag, std::vector<Cell> & cells) const = 0;
     virtual void lookupSegment(Tag tag, uint32_t offset, int16_t maxSize,
                                std::vector<Cell> & cells, bool & cont, int16_t & wrap) const = 0;
     virtual size_t lookupLength(Tag tag) const = 0;
     virtual void remove(Tag tag) = 0;
+    // Remove 'count' tags at once. Tags may repeat.
+    virtual void removeBatch(const Tag * tags, size_t count) = 0;
+
+    // Support for snapshots (see snapshot.hxx):
+    // Take another reference to each of 'count' tags. Tags may repeat.
+    virtual void retainBatch(const Tag * tags, size_t count) = 0;
+    // Get the length and encoded form of an entry.
+    virtual void exportEntry(Tag tag, uint32_t & length, std::vector<uint8_t> & bytes) const = 0;
+    // Add an entry exported by a previous instance with 'refs' references,
+    // returning false if the tag is taken. The bytes are used in place, so
+    // must outlive the deduper.
+    virtual bool importEntry(Tag tag, uint32_t length,
+                             const uint8_t * bytes, uint32_t size, uint32_t refs) = 0;
+
+    // Support for searching (see searcher.hxx):
+    // Get the tags of the entries that may contain each of 'literals', sorted,
+    // returning false if there is no index to narrow them down.
+    virtual bool findCandidates(const std::vector<std::string> & literals,
+                                std::vector<Tag>               & tags) const = 0;
 
     virtual void getLineStats(uint32_t & uniqueLines, uint32_t & totalLines) const = 0;
+    // Bytes of the encoded entries, once each and once per reference.
     virtual void getByteStats(size_t & uniqueBytes, size_t & totalBytes) const = 0;
+    // Bytes of the entries held in memory, the compressed entries counted at
+    // their compressed size.
+    virtual size_t getResidentBytes() const = 0;
+    // Bytes of the entries held compressed, before and after compression.
+    virtual void getCompressionStats(size_t & rawBytes, size_t & compressedBytes) const = 0;
+    // Number of lookups and their mean latency, for uncompressed (hot) and
+    // compressed (warm) entries.
+    virtual void getLookupStats(uint32_t & hotLookups, double & hotMicros,
+                                uint32_t & warmLookups, double & warmMicros) const = 0;
+    // Bytes of compressed entries spilled to disk, and the size of the file.
+    virtual void getSpillStats(size_t & spilledBytes, size_t & fileBytes) const = 0;
     virtual void dump(std::ostream & ost) const = 0;
 
 protected:
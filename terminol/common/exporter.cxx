@@ -0,0 +1,264 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/exporter.hxx"
+#include "terminol/support/debug.hxx"
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace {
+
+// Paragraphs encoded at a time by a thread.
+const size_t CHUNK_PARAS = 1024;
+
+// Most threads encoding at once.
+const size_t MAX_THREADS = 4;
+
+const struct {
+    Attr attr;
+    int  sgr;
+} ATTR_SGRS[] = {
+    { Attr::BOLD,      1 },
+    { Attr::FAINT,     2 },
+    { Attr::ITALIC,    3 },
+    { Attr::UNDERLINE, 4 },
+    { Attr::BLINK,     5 },
+    { Attr::INVERSE,   7 },
+    { Attr::CONCEAL,   8 }
+};
+
+void appendArg(int arg, std::string & text) {
+    text.push_back(';');
+    text += std::to_string(arg);
+}
+
+// Append the SGR arguments selecting 'color', 'base' is 30 for the
+// foreground and 40 for the background. Stock colors are the defaults.
+void appendColor(const UColor & color, int base, std::string & text) {
+    switch (color.type) {
+        case UColor::Type::STOCK:
+            break;
+        case UColor::Type::INDEXED:
+            if (color.index < 8) {
+                appendArg(base + color.index, text);
+            }
+            else if (color.index < 16) {
+                appendArg(base + 60 + color.index - 8, text);
+            }
+            else {
+                appendArg(base + 8, text);
+                appendArg(5, text);
+                appendArg(color.index, text);
+            }
+            break;
+        case UColor::Type::DIRECT:
+            appendArg(base + 8, text);
+            appendArg(2, text);
+            appendArg(color.values.r, text);
+            appendArg(color.values.g, text);
+            appendArg(color.values.b, text);
+            break;
+    }
+}
+
+bool writeAll(int fd, const void * data, size_t size) {
+    auto bytes = static_cast<const uint8_t *>(data);
+
+    while (size != 0) {
+        auto rval = TEMP_FAILURE_RETRY(::write(fd, bytes, size));
+
+        if (rval == -1) {
+            return false;
+        }
+
+        bytes += rval;
+        size  -= rval;
+    }
+
+    return true;
+}
+
+} // namespace {anonymous}
+
+Exporter::Exporter(I_Deduper                       & deduper,
+                   std::vector<I_Deduper::Tag>    && tags,
+                   std::vector<std::vector<Cell>> && paras,
+                   const std::string               & path,
+                   bool                              styles) throw (Error) :
+    _deduper(deduper),
+    _tags(std::move(tags)),
+    _paras(std::move(paras)),
+    _path(path),
+    _styles(styles),
+    _fd(-1),
+    _chunks((_tags.size() + _paras.size() + CHUNK_PARAS - 1) / CHUNK_PARAS),
+    _window(0),
+    _nextEncode(0),
+    _nextWrite(0),
+    _encoded(),
+    _writing(false),
+    _error(),
+    _mutex(),
+    _condition(),
+    _threads()
+{
+    _fd = TEMP_FAILURE_RETRY(::open(path.c_str(),
+                                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+
+    if (_fd == -1) {
+        throw Error("Failed to create " + path + ": " + std::string(::strerror(errno)));
+    }
+
+    if (!_tags.empty()) {
+        _deduper.retainBatch(&_tags.front(), _tags.size());
+    }
+
+    auto threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                    std::min(MAX_THREADS, _chunks));
+    _window = 2 * threads;
+
+    for (size_t i = 0; i != threads; ++i) {
+        _threads.emplace_back(&Exporter::work, this);
+    }
+}
+
+Exporter::~Exporter() {
+    for (auto & thread : _threads) {
+        thread.join();
+    }
+
+    if (!_tags.empty()) {
+        _deduper.removeBatch(&_tags.front(), _tags.size());
+    }
+
+    ENFORCE_SYS(TEMP_FAILURE_RETRY(::close(_fd)) != -1, "");
+}
+
+bool Exporter::isFinished(std::string & error) const {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (!_error.empty()) {
+        error = _error;
+        return !_writing;
+    }
+
+    return _nextWrite == _chunks;
+}
+
+void Exporter::work() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        // Don't get too far ahead of the writer.
+        _condition.wait(lock, [this]{
+            return !_error.empty() || _nextEncode == _chunks || _nextEncode < _nextWrite + _window;
+        });
+
+        if (!_error.empty() || _nextEncode == _chunks) {
+            break;
+        }
+
+        auto chunk = _nextEncode++;
+
+        lock.unlock();
+        std::string text;
+        encode(chunk, text);
+        lock.lock();
+
+        _encoded.insert(std::make_pair(chunk, std::move(text)));
+
+        // Write the chunks that are due, one thread at a time. The writer
+        // picks up the chunks encoded by the others in the meantime.
+        while (!_writing && _error.empty()) {
+            auto iter = _encoded.find(_nextWrite);
+
+            if (iter == _encoded.end()) {
+                break;
+            }
+
+            auto due = std::move(iter->second);
+            _encoded.erase(iter);
+            _writing = true;
+
+            lock.unlock();
+            auto written = writeAll(_fd, due.data(), due.size());
+            auto error   = errno;
+            lock.lock();
+
+            _writing = false;
+
+            if (written) {
+                ++_nextWrite;
+            }
+            else {
+                _error = "Failed to write " + _path + ": " + std::string(::strerror(error));
+                _encoded.clear();
+            }
+
+            _condition.notify_all();
+        }
+    }
+}
+
+void Exporter::encode(size_t chunk, std::string & text) const {
+    auto count = _tags.size() + _paras.size();
+    auto begin = chunk * CHUNK_PARAS;
+    auto end   = std::min(begin + CHUNK_PARAS, count);
+
+    const Style       plain;
+    std::vector<Cell> scratch;
+
+    for (auto i = begin; i != end; ++i) {
+        const std::vector<Cell> * cells;
+
+        if (i < _tags.size()) {
+            scratch.clear();
+            _deduper.lookup(_tags[i], scratch);
+            cells = &scratch;
+        }
+        else {
+            cells = &_paras[i - _tags.size()];
+        }
+
+        auto style = plain;
+
+        for (auto & cell : *cells) {
+            if (_styles && cell.style != style) {
+                style = cell.style;
+                encodeStyle(style, text);
+            }
+
+            auto & seq = cell.seq;
+            text.append(reinterpret_cast<const char *>(&seq.bytes[0]),
+                        utf8::leadLength(seq.lead()));
+        }
+
+        // Each line stands alone.
+        if (style != plain) {
+            text += "\x1B[0m";
+        }
+
+        text.push_back('\n');
+    }
+}
+
+void Exporter::encodeStyle(const Style & style, std::string & text) const {
+    // Reset, then set the whole style.
+    text += "\x1B[0";
+
+    for (auto & attrSgr : ATTR_SGRS) {
+        if (style.attrs.get(attrSgr.attr)) {
+            appendArg(attrSgr.sgr, text);
+        }
+    }
+
+    appendColor(style.fg, 30, text);
+    appendColor(style.bg, 40, text);
+
+    text.push_back('m');
+}
@@ -0,0 +1,69 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__EXPORTER__HXX
+#define COMMON__EXPORTER__HXX
+
+#include "terminol/common/deduper_interface.hxx"
+#include "terminol/support/destroyer_interface.hxx"
+#include "terminol/support/pattern.hxx"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Exporter writes a snapshot of a history to a file as UTF-8 text, a line per
+// paragraph, optionally with SGR escapes to preserve the styles. Chunks of
+// paragraphs are decoded by several threads and written in order, so the
+// export proceeds at disk speed without holding up the UI thread.
+// Destroying an Exporter waits for the export to finish, so a window that
+// goes away first may hand it to an I_Destroyer.
+class Exporter : public I_Destroyer::Garbage, private Uncopyable {
+public:
+    struct Error {
+        explicit Error(const std::string & message_) : message(message_) {}
+        std::string message;
+    };
+
+    // The paragraphs are 'tags' followed by 'paras', oldest first. A
+    // reference is taken to each of the tags for the duration.
+    Exporter(I_Deduper                       & deduper,
+             std::vector<I_Deduper::Tag>    && tags,
+             std::vector<std::vector<Cell>> && paras,
+             const std::string               & path,
+             bool                              styles) throw (Error);
+    virtual ~Exporter();
+
+    const std::string & getPath() const { return _path; }
+
+    // Return true once the export has finished, setting 'error' if it failed.
+    bool isFinished(std::string & error) const;
+
+protected:
+    void work();
+    void encode(size_t chunk, std::string & text) const;
+    void encodeStyle(const Style & style, std::string & text) const;
+
+private:
+    I_Deduper                            & _deduper;
+    const std::vector<I_Deduper::Tag>      _tags;
+    const std::vector<std::vector<Cell>>   _paras;
+    const std::string                      _path;
+    const bool                             _styles;
+    int                                    _fd;
+    size_t                                 _chunks;
+    size_t                                 _window;        // Most chunks encoded ahead of the writer.
+    size_t                                 _nextEncode;    // Chunk to encode next.
+    size_t                                 _nextWrite;     // Chunk to write next.
+    std::map<size_t, std::string>          _encoded;       // Awaiting their turn to be written.
+    bool                                   _writing;       // Is a thread writing?
+    std::string                            _error;         // Empty unless writing failed.
+    mutable std::mutex                     _mutex;
+    std::condition_variable                _condition;
+    std::vector<std::thread>               _threads;
+};
+
+#endif // COMMON__EXPORTER__HXX
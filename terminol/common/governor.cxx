@@ -0,0 +1,106 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/governor.hxx"
+
+#include <algorithm>
+
+namespace {
+
+// Once over budget, trim to this fraction of the budget below it so that
+// trimming isn't repeated for every new line.
+const size_t SLACK_DIVISOR = 8;
+
+} // namespace {anonymous}
+
+Governor::Governor(const Config & config, const I_Deduper & deduper) :
+    _config(config),
+    _deduper(deduper),
+    _clients(),
+    _stuckBytes(0) {}
+
+void Governor::add(I_Client * client) {
+    ASSERT(std::find(_clients.begin(), _clients.end(), client) == _clients.end(), "");
+    _clients.push_back(client);
+}
+
+void Governor::remove(I_Client * client) {
+    auto iter = std::find(_clients.begin(), _clients.end(), client);
+    ASSERT(iter != _clients.end(), "");
+    _clients.erase(iter);
+}
+
+void Governor::enforce() {
+    if (_config.historyBudget == 0 || _clients.empty()) {
+        return;
+    }
+
+    size_t uniqueBytes, totalBytes;
+    _deduper.getByteStats(uniqueBytes, totalBytes);
+
+    auto slack = _config.historyBudget / SLACK_DIVISOR;
+
+    if (uniqueBytes <= _config.historyBudget) {
+        _stuckBytes = 0;
+        return;
+    }
+    else if (_stuckBytes != 0 && uniqueBytes <= _stuckBytes + slack) {
+        // The last attempt freed nothing, wait for more history.
+        return;
+    }
+
+    auto target = _config.historyBudget - slack;
+
+    _stuckBytes = 0;
+
+    while (uniqueBytes > target) {
+        size_t cells = 0;
+
+        for (auto client : _clients) {
+            cells += client->governorHistorySize();
+        }
+
+        if (cells == 0 || totalBytes == 0) {
+            // Nothing left that we can trim.
+            break;
+        }
+
+        // Estimate the number of cells to discard from the average bytes per
+        // cell. Deduplicated and pinned paragraphs free less than this, hence
+        // the loop.
+        auto trim = std::max<size_t>(
+            1, static_cast<double>(uniqueBytes - target) * cells / totalBytes);
+
+        switch (_config.historyPolicy) {
+            case HistoryPolicy::LARGEST: {
+                auto largest = *std::max_element(
+                    _clients.begin(), _clients.end(),
+                    [](const I_Client * lhs, const I_Client * rhs) {
+                        return lhs->governorHistorySize() < rhs->governorHistorySize();
+                    });
+                largest->governorTrimHistory(trim);
+                break;
+            }
+            case HistoryPolicy::PROPORTIONAL:
+                for (auto client : _clients) {
+                    auto size = client->governorHistorySize();
+
+                    if (size != 0) {
+                        client->governorTrimHistory(
+                            std::max<size_t>(1, static_cast<double>(trim) * size / cells));
+                    }
+                }
+                break;
+        }
+
+        auto before = uniqueBytes;
+        _deduper.getByteStats(uniqueBytes, totalBytes);
+
+        if (uniqueBytes >= before) {
+            // What's left is pinned by other holders. Trimming more would
+            // only discard history without getting any closer.
+            _stuckBytes = uniqueBytes;
+            break;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__GOVERNOR__HXX
+#define COMMON__GOVERNOR__HXX
+
+#include "terminol/common/config.hxx"
+#include "terminol/common/deduper_interface.hxx"
+#include "terminol/support/pattern.hxx"
+
+#include <vector>
+
+// Governor keeps the history of its clients, the windows sharing a deduper,
+// within Config::historyBudget bytes. The deduper does the byte accounting;
+// the clients are trimmed, oldest history first, according to
+// Config::historyPolicy.
+// Entries that are also held elsewhere, e.g. by a history snapshot, an export,
+// a copied selection or a hibernating screen, count against the budget but
+// aren't freed by trimming. Trimming stops once it frees nothing, and isn't
+// tried again until the history has grown by the slack.
+class Governor : private Uncopyable {
+public:
+    class I_Client {
+    public:
+        // Return the size of the client's history, in cells.
+        virtual size_t governorHistorySize() const = 0;
+        // Discard at least 'cells' cells of the oldest history, if there is that much.
+        virtual void governorTrimHistory(size_t cells) = 0;
+
+    protected:
+        ~I_Client() {}
+    };
+
+private:
+    const Config           & _config;
+    const I_Deduper        & _deduper;
+    std::vector<I_Client *>  _clients;
+    size_t                   _stuckBytes;   // Unique bytes when trimming last freed nothing, 0 -> none.
+
+public:
+    Governor(const Config & config, const I_Deduper & deduper);
+
+    void add(I_Client * client);
+    void remove(I_Client * client);
+
+    // Trim the clients if the deduper has exceeded the budget. Cheap enough to
+    // call every iteration of the event loop.
+    void enforce();
+};
+
+#endif // COMMON__GOVERNOR__HXX
@@ -0,0 +1,94 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/ingester.hxx"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// Number of queued paragraphs that wakes the background thread, and the
+// most it stores at a time. Waking it for every paragraph would cost a
+// context switch per line of output.
+const size_t BATCH = 64;
+
+} // namespace {anonymous}
+
+Ingester::Ingester(I_Deduper & deduper) :
+    _deduper(deduper),
+    _queue(),
+    _done(),
+    _urgent(false),
+    _finalised(false),
+    _mutex(),
+    _condition(),
+    _thread(&Ingester::background, this) {}
+
+Ingester::~Ingester() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finalised = true;
+        _condition.notify_all();
+    }
+
+    _thread.join();
+}
+
+void Ingester::submit(const std::vector<Cell> & cells) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _queue.push_back(&cells);
+
+    if (_queue.size() == BATCH) {
+        _condition.notify_all();
+    }
+}
+
+void Ingester::collect(std::vector<I_Deduper::Tag> & tags, size_t backlog) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_queue.size() > backlog) {
+        _urgent = true;
+        _condition.notify_all();
+        _condition.wait(lock, [this, backlog]{ return _queue.size() <= backlog; });
+        _urgent = false;
+    }
+
+    std::copy(_done.begin(), _done.end(), back_inserter(tags));
+    _done.clear();
+}
+
+void Ingester::background() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _condition.wait(lock, [this]{
+            return _finalised || _queue.size() >= BATCH || (_urgent && !_queue.empty());
+        });
+
+        // Finish storing everything that was submitted before exiting.
+        if (_queue.empty()) {
+            break;
+        }
+
+        // Once woken, keep going until the queue is empty.
+        while (!_queue.empty()) {
+            // The paragraphs stay queued until they are stored, so that
+            // collect() can wait for them.
+            auto count = std::min(_queue.size(), BATCH);
+            std::vector<const std::vector<Cell> *> cells(_queue.begin(), _queue.begin() + count);
+            std::vector<I_Deduper::Tag>            tags(count);
+
+            lock.unlock();
+            _deduper.storeBatch(&cells.front(), count, &tags.front());
+            lock.lock();
+
+            _queue.erase(_queue.begin(), _queue.begin() + count);
+            std::copy(tags.begin(), tags.end(), back_inserter(_done));
+
+            if (_urgent) {
+                _condition.notify_all();
+            }
+        }
+    }
+}
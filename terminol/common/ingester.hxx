@@ -0,0 +1,48 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__INGESTER__HXX
+#define COMMON__INGESTER__HXX
+
+#include "terminol/common/deduper_interface.hxx"
+#include "terminol/support/pattern.hxx"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Ingester stores paragraphs with the deduper on a background thread so
+// that the (UI thread) Buffer doesn't wait on encoding and hashing as
+// lines scroll into history.
+// Paragraphs are stored in batches, and their tags collected, in
+// submission order.
+// The caller must keep each submitted paragraph alive and unmodified until
+// its tag has been collected.
+class Ingester : private Uncopyable {
+public:
+    explicit Ingester(I_Deduper & deduper);
+    ~Ingester();
+
+    void submit(const std::vector<Cell> & cells);
+
+    // Wait until no more than 'backlog' paragraphs remain to be stored, then
+    // append the tags of the paragraphs stored so far.
+    void collect(std::vector<I_Deduper::Tag> & tags, size_t backlog);
+
+protected:
+    void background();
+
+private:
+    I_Deduper                               & _deduper;
+    std::deque<const std::vector<Cell> *>     _queue;       // Submitted but not yet stored.
+    std::vector<I_Deduper::Tag>               _done;        // Stored but not yet collected.
+    bool                                      _urgent;      // Is collect() waiting?
+    bool                                      _finalised;
+    std::mutex                                _mutex;
+    std::condition_variable                   _condition;
+    std::thread                               _thread;
+};
+
+#endif // COMMON__INGESTER__HXX
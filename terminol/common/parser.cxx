@@ -5,6 +5,7 @@
 #include "terminol/common/key_map.hxx"
 #include "terminol/support/conv.hxx"
 #include "terminol/support/debug.hxx"
+#include "terminol/support/regex.hxx"
 
 #include <fstream>
 #include <unordered_map>
@@ -72,6 +73,7 @@ protected:
     void interpretTokens(const std::vector<std::string> & tokens) throw (ParseError);
     void handleSet(const std::string & key, const std::string & value) throw (ParseError);
     void handleBindSym(const std::string & sym, const std::string & action) throw (ParseError);
+    void handleHighlight(const std::string & color, const std::string & pattern) throw (ParseError);
 };
 
 //
@@ -101,8 +103,34 @@ Parser::Parser(Config & config) : _config(config) {
                           );
 
     registerSimpleHandler("unlimited-scroll-back", _config.unlimitedScrollBack);
+    registerSimpleHandler("history-budget", _config.historyBudget);
+
+    registerGenericHandler("history-budget-policy",
+                           [&](const std::string & value)
+                           {
+                           if (value == "largest") {
+                               _config.historyPolicy = HistoryPolicy::LARGEST;
+                           }
+                           else if (value == "proportional") {
+                               _config.historyPolicy = HistoryPolicy::PROPORTIONAL;
+                           }
+                           else {
+                               throw ParseError("Bad history-budget-policy: '" + value + "'");
+                           }
+                           }
+                          );
+
+    registerSimpleHandler("history-memory", _config.historyMemory);
+    registerSimpleHandler("history-spill-dir", _config.historySpillDir);
+    registerSimpleHandler("history-snapshot", _config.historySnapshot);
+    registerSimpleHandler("history-index", _config.historyIndex);
+    registerSimpleHandler("history-export-dir", _config.historyExportDir);
+    registerSimpleHandler("history-export-styles", _config.historyExportStyles);
+
     registerSimpleHandler("frames-per-second", _config.framesPerSecond);
     registerSimpleHandler("traditional-wrapping", _config.traditionalWrapping);
+    registerSimpleHandler("alt-buffer-release-delay", _config.altBufferReleaseDelay);
+    registerSimpleHandler("hibernate-delay", _config.hibernateDelay);
     registerSimpleHandler("trace-tty", _config.traceTty);
     registerSimpleHandler("sync-tty", _config.syncTty);
     registerSimpleHandler("initial-x", _config.initialX);
@@ -202,6 +230,8 @@ Parser::Parser(Config & config) : _config(config) {
     //
 
     _actions.insert(std::make_pair("search",               Action::SEARCH));
+    _actions.insert(std::make_pair("search-next",          Action::SEARCH_NEXT));
+    _actions.insert(std::make_pair("search-prev",          Action::SEARCH_PREV));
     _actions.insert(std::make_pair("window-narrower",      Action::WINDOW_NARROWER));
     _actions.insert(std::make_pair("window-wider",         Action::WINDOW_WIDER));
     _actions.insert(std::make_pair("window-shorter",       Action::WINDOW_SHORTER));
@@ -220,7 +250,10 @@ Parser::Parser(Config & config) : _config(config) {
     _actions.insert(std::make_pair("scroll-down-page",     Action::SCROLL_DOWN_PAGE));
     _actions.insert(std::make_pair("scroll-top",           Action::SCROLL_TOP));
     _actions.insert(std::make_pair("scroll-bottom",        Action::SCROLL_BOTTOM));
+    _actions.insert(std::make_pair("scroll-prev-prompt",   Action::SCROLL_PREV_PROMPT));
+    _actions.insert(std::make_pair("scroll-next-prompt",   Action::SCROLL_NEXT_PROMPT));
     _actions.insert(std::make_pair("clear-history",        Action::CLEAR_HISTORY));
+    _actions.insert(std::make_pair("save-history",         Action::SAVE_HISTORY));
     _actions.insert(std::make_pair("debug-global-tags",    Action::DEBUG_GLOBAL_TAGS));
     _actions.insert(std::make_pair("debug-local-tags",     Action::DEBUG_LOCAL_TAGS));
     _actions.insert(std::make_pair("debug-history",        Action::DEBUG_HISTORY));
@@ -321,6 +354,14 @@ void Parser::interpretTokens(const std::vector<std::string> & tokens) throw (Par
             throw ParseError("Syntax: 'bindsym KEY ACTION'");
         }
     }
+    else if (tokens[0] == "highlight") {
+        if (tokens.size() == 3) {
+            handleHighlight(tokens[1], tokens[2]);
+        }
+        else {
+            throw ParseError("Syntax: 'highlight COLOR PATTERN'");
+        }
+    }
     else {
         throw ParseError("Unrecognised token: '" + tokens[0] + "'");
     }
@@ -367,6 +408,21 @@ void Parser::handleBindSym(const std::string & sym, const std::string & action)
     }
 }
 
+void Parser::handleHighlight(const std::string & color, const std::string & pattern) throw (ParseError) {
+    Highlight highlight;
+    highlight.pattern = pattern;
+    highlight.fg      = unstringify<Color>(color);
+
+    try {
+        Regex regex(pattern);
+    }
+    catch (const Regex::Error & error) {
+        throw ParseError(error.message);
+    }
+
+    _config.highlights.push_back(highlight);
+}
+
 //
 //
 //
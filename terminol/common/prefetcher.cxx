@@ -0,0 +1,108 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/prefetcher.hxx"
+
+#include <algorithm>
+#include <iterator>
+
+Prefetcher::Prefetcher(const I_Deduper & deduper) :
+    _deduper(deduper),
+    _tags(),
+    _next(0),
+    _done(),
+    _requested(),
+    _current(I_Deduper::invalidTag()),
+    _generation(0),
+    _busy(false),
+    _finalised(false),
+    _mutex(),
+    _condition(),
+    _thread(&Prefetcher::background, this) {}
+
+Prefetcher::~Prefetcher() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finalised = true;
+        _condition.notify_all();
+    }
+
+    _thread.join();
+}
+
+void Prefetcher::request(std::vector<I_Deduper::Tag> && tags) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _tags = std::move(tags);
+    _next = 0;
+    _requested.clear();
+    _requested.insert(_tags.begin(), _tags.end());
+
+    for (auto & para : _done) {
+        _requested.insert(para.tag);
+    }
+
+    _condition.notify_all();
+}
+
+void Prefetcher::cancel() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _tags.clear();
+    _next = 0;
+    ++_generation;
+    _condition.wait(lock, [this]{ return !_busy; });
+    _done.clear();
+    _requested.clear();
+}
+
+void Prefetcher::collect(std::vector<Para> & paras) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::move(_done.begin(), _done.end(), back_inserter(paras));
+    _done.clear();
+}
+
+void Prefetcher::forget(I_Deduper::Tag tag) {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_requested.count(tag) == 0 && !(_busy && _current == tag)) {
+            return;
+        }
+    }
+
+    cancel();
+}
+
+void Prefetcher::background() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _condition.wait(lock, [this]{ return _finalised || _next != _tags.size(); });
+
+        if (_finalised) {
+            break;
+        }
+
+        auto tag        = _tags[_next++];
+        auto generation = _generation;
+        _current = tag;
+        _busy    = true;
+
+        // Decode without the lock so the UI thread can collect, or replace
+        // the request, in the meantime.
+        lock.unlock();
+        std::vector<Cell> cells;
+        _deduper.lookup(tag, cells);
+        lock.lock();
+
+        _busy = false;
+
+        // Keep the paragraph unless the request was cancelled meanwhile,
+        // in which case the tag may no longer be valid.
+        if (_generation == generation) {
+            _done.emplace_back(tag, std::move(cells));
+            _requested.insert(tag);     // It may be from a replaced request.
+        }
+
+        _condition.notify_all();
+    }
+}
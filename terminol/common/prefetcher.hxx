@@ -0,0 +1,64 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__PREFETCHER__HXX
+#define COMMON__PREFETCHER__HXX
+
+#include "terminol/common/deduper_interface.hxx"
+#include "terminol/support/pattern.hxx"
+
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Prefetcher decodes paragraphs on a background thread so that they are
+// ready by the time the (UI thread) Buffer needs them.
+// The caller must keep the requested tags alive until the request has been
+// collected or cancelled.
+class Prefetcher : private Uncopyable {
+public:
+    struct Para {
+        I_Deduper::Tag    tag;
+        std::vector<Cell> cells;
+
+        Para(I_Deduper::Tag tag_, std::vector<Cell> && cells_) :
+            tag(tag_), cells(std::move(cells_)) {}
+    };
+
+    explicit Prefetcher(const I_Deduper & deduper);
+    ~Prefetcher();
+
+    // Replace any outstanding request.
+    void request(std::vector<I_Deduper::Tag> && tags);
+
+    // Abandon the outstanding request, including any decoded but uncollected
+    // paragraphs. On return the background thread has finished with its tags.
+    void cancel();
+
+    // Append the paragraphs decoded so far.
+    void collect(std::vector<Para> & paras);
+
+    // Cancel if 'tag', which is about to be released, may still be used.
+    void forget(I_Deduper::Tag tag);
+
+protected:
+    void background();
+
+private:
+    const I_Deduper                   & _deduper;
+    std::vector<I_Deduper::Tag>         _tags;       // Outstanding request.
+    size_t                              _next;       // Index into _tags of the next to decode.
+    std::vector<Para>                   _done;       // Decoded but not yet collected.
+    std::unordered_set<I_Deduper::Tag>  _requested;  // Tags of _tags and _done, at least.
+    I_Deduper::Tag                      _current;    // Being decoded, if _busy.
+    uint32_t                            _generation; // Incremented by cancel().
+    bool                                _busy;       // Is background() decoding a tag?
+    bool                                _finalised;
+    std::mutex                          _mutex;
+    std::condition_variable             _condition;
+    std::thread                         _thread;
+};
+
+#endif // COMMON__PREFETCHER__HXX
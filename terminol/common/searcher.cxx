@@ -0,0 +1,173 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/searcher.hxx"
+
+#include <algorithm>
+#include <iterator>
+
+Searcher::Searcher(const I_Deduper & deduper) :
+    _deduper(deduper),
+    _regex(),
+    _literals(),
+    _candidates(),
+    _filter(false),
+    _tags(),
+    _paras(),
+    _next(0),
+    _done(),
+    _generation(0),
+    _busy(false),
+    _finalised(false),
+    _mutex(),
+    _condition(),
+    _thread(&Searcher::background, this) {}
+
+Searcher::~Searcher() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finalised = true;
+        _condition.notify_all();
+    }
+
+    _thread.join();
+}
+
+void Searcher::start(std::unique_ptr<Regex>   && regex,
+                     std::vector<std::string> && literals,
+                     Tags                        tags,
+                     Paras                       paras) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    ++_generation;
+    // The paragraph being searched is read without the lock.
+    _condition.wait(lock, [this]{ return !_busy; });
+    _regex    = std::move(regex);
+    _literals = std::move(literals);
+    _candidates.clear();
+    _filter   = false;
+    _tags     = std::move(tags);
+    _paras    = std::move(paras);
+    _next     = _tags->size() + _paras->size();
+    _done.clear();
+    _condition.notify_all();
+}
+
+void Searcher::cancel() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    ++_generation;
+    _next = 0;
+    _condition.wait(lock, [this]{ return !_busy; });
+    _literals.clear();
+    _candidates.clear();
+    _tags.reset();
+    _paras.reset();
+    _done.clear();
+}
+
+bool Searcher::collect(std::vector<Match> & matches) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::copy(_done.begin(), _done.end(), back_inserter(matches));
+    _done.clear();
+    return _next == 0 && !_busy;
+}
+
+void Searcher::background() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _condition.wait(lock, [this]{ return _finalised || _next != 0; });
+
+        if (_finalised) {
+            break;
+        }
+
+        if (!_literals.empty()) {
+            auto literals   = std::move(_literals);
+            auto generation = _generation;
+            _literals.clear();
+            _busy = true;
+
+            lock.unlock();
+            std::vector<I_Deduper::Tag> candidates;
+            auto filter = _deduper.findCandidates(literals, candidates);
+            lock.lock();
+
+            _busy = false;
+
+            if (_generation == generation) {
+                _filter     = filter;
+                _candidates = std::move(candidates);
+            }
+
+            _condition.notify_all();
+            continue;
+        }
+
+        if (_filter && _next <= _tags->size() &&
+            !std::binary_search(_candidates.begin(), _candidates.end(), (*_tags)[_next - 1]))
+        {
+            // The paragraph can't match. Skip it without decoding.
+            --_next;
+            continue;
+        }
+
+        auto   index      = static_cast<uint32_t>(--_next);
+        auto   generation = _generation;
+        auto & tags       = *_tags;
+        auto & paras      = *_paras;
+        _busy = true;
+
+        // Search without the lock so the UI thread can collect in the
+        // meantime. Replacing the search waits for us.
+        lock.unlock();
+        std::vector<Match> matches;
+
+        if (index < tags.size()) {
+            std::vector<Cell> cells;
+            _deduper.lookup(tags[index], cells);
+            match(index, cells, matches);
+        }
+        else {
+            match(index, paras[index - tags.size()], matches);
+        }
+
+        lock.lock();
+
+        _busy = false;
+
+        if (_generation == generation) {
+            std::copy(matches.begin(), matches.end(), back_inserter(_done));
+        }
+
+        _condition.notify_all();
+    }
+}
+
+void Searcher::match(uint32_t index, const std::vector<Cell> & cells,
+                     std::vector<Match> & matches) const {
+    // Encode the paragraph, remembering where each cell starts.
+    std::vector<char>     text;
+    std::vector<uint32_t> starts;
+
+    for (auto & cell : cells) {
+        auto & seq = cell.seq;
+        starts.push_back(text.size());
+        text.insert(text.end(), &seq.bytes[0], &seq.bytes[utf8::leadLength(seq.lead())]);
+    }
+
+    if (text.empty()) {
+        return;
+    }
+
+    auto allOffsets = _regex->matchAllOffsets(&text.front(), text.size());
+
+    // Most recent first, so the last match in the paragraph comes first.
+    for (auto iter = allOffsets.rbegin(); iter != allOffsets.rend(); ++iter) {
+        auto & whole = iter->front();
+        uint32_t begin = std::upper_bound(starts.begin(), starts.end(),
+                                          static_cast<uint32_t>(whole.first)) - starts.begin() - 1;
+        uint32_t end   = std::lower_bound(starts.begin(), starts.end(),
+                                          static_cast<uint32_t>(whole.last)) - starts.begin();
+        matches.emplace_back(index, begin, end);
+    }
+}
@@ -0,0 +1,81 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__SEARCHER__HXX
+#define COMMON__SEARCHER__HXX
+
+#include "terminol/common/deduper_interface.hxx"
+#include "terminol/support/pattern.hxx"
+#include "terminol/support/regex.hxx"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Searcher matches a regex against a snapshot of the history on a background
+// thread so that the (UI thread) Buffer stays responsive while searching a
+// large history. Matches are collected as they are found, most recent first.
+// Given literals that every match must contain, the deduper's index (if it
+// keeps one) is consulted first, so that only the stored paragraphs that may
+// match are decoded.
+// The snapshot is shared with the caller, so that a new pattern can be
+// searched without taking another. The caller must keep the tags of the
+// snapshot alive until the search has finished or been cancelled.
+class Searcher : private Uncopyable {
+public:
+    struct Match {
+        uint32_t index;     // Paragraph, 0 -> the oldest.
+        uint32_t begin;     // Cell offset of the first matched cell.
+        uint32_t end;       // Cell offset beyond the last matched cell.
+
+        Match(uint32_t index_, uint32_t begin_, uint32_t end_) :
+            index(index_), begin(begin_), end(end_) {}
+    };
+
+    typedef std::shared_ptr<const std::vector<I_Deduper::Tag>>    Tags;
+    typedef std::shared_ptr<const std::vector<std::vector<Cell>>> Paras;
+
+    explicit Searcher(const I_Deduper & deduper);
+    ~Searcher();
+
+    // Replace any outstanding search. The paragraphs of the snapshot are
+    // 'tags' followed by 'paras', oldest first. See Regex::requiredLiterals().
+    void start(std::unique_ptr<Regex>   && regex,
+               std::vector<std::string> && literals,
+               Tags                        tags,
+               Paras                       paras);
+
+    // Abandon the outstanding search, including any uncollected matches.
+    // On return the background thread has finished with its tags.
+    void cancel();
+
+    // Append the matches found so far. Return true if the search has
+    // finished, in which case the background thread is done with its tags.
+    bool collect(std::vector<Match> & matches);
+
+protected:
+    void background();
+    void match(uint32_t index, const std::vector<Cell> & cells,
+               std::vector<Match> & matches) const;
+
+private:
+    const I_Deduper                & _deduper;
+    std::unique_ptr<Regex>           _regex;
+    std::vector<std::string>         _literals;     // Cleared once the candidates are found.
+    std::vector<I_Deduper::Tag>      _candidates;   // Sorted.
+    bool                             _filter;       // Only search the candidates?
+    Tags                             _tags;         // Null unless searching.
+    Paras                            _paras;        // Ditto.
+    size_t                           _next;         // Paragraphs still to search.
+    std::vector<Match>               _done;         // Found but not yet collected.
+    uint32_t                         _generation;   // Incremented by start() and cancel().
+    bool                             _busy;         // Is background() searching a paragraph?
+    bool                             _finalised;
+    std::mutex                       _mutex;
+    std::condition_variable          _condition;
+    std::thread                      _thread;
+};
+
+#endif // COMMON__SEARCHER__HXX
@@ -0,0 +1,71 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/selected_text.hxx"
+
+#include <algorithm>
+
+SelectedText::SelectedText(I_Deduper                       & deduper,
+                           std::vector<I_Deduper::Tag>    && tags,
+                           std::vector<std::vector<Cell>> && paras,
+                           uint32_t                          beginOffset,
+                           uint32_t                          endOffset,
+                           size_t                            cells) :
+    _deduper(deduper),
+    _tags(std::move(tags)),
+    _paras(std::move(paras)),
+    _beginOffset(beginOffset),
+    _endOffset(endOffset),
+    _cells(cells) {}
+
+SelectedText::~SelectedText() {
+    if (!_tags.empty()) {
+        _deduper.removeBatch(&_tags.front(), _tags.size());
+    }
+}
+
+bool SelectedText::read(Cursor & cursor, std::string & text, size_t size) const {
+    auto count = _tags.size() + _paras.size();
+
+    if (cursor.index == count) {
+        return false;
+    }
+
+    std::vector<Cell> scratch;
+
+    while (cursor.index != count && text.size() < size) {
+        const std::vector<Cell> * cells;
+
+        if (cursor.index < _tags.size()) {
+            scratch.clear();
+            _deduper.lookup(_tags[cursor.index], scratch);
+            cells = &scratch;
+        }
+        else {
+            cells = &_paras[cursor.index - _tags.size()];
+        }
+
+        uint32_t length = cells->size();
+        auto     last   = cursor.index + 1 == count;
+        auto     end    = last ? std::min(_endOffset, length) : length;
+
+        for (; cursor.offset < end && text.size() < size; ++cursor.offset) {
+            auto & seq = (*cells)[cursor.offset].seq;
+            text.append(reinterpret_cast<const char *>(&seq.bytes[0]),
+                        utf8::leadLength(seq.lead()));
+        }
+
+        if (cursor.offset < end) {
+            break;
+        }
+
+        if (!last || _endOffset > length) {
+            text.push_back('\n');
+        }
+
+        ++cursor.index;
+        cursor.offset = 0;
+    }
+
+    return true;
+}
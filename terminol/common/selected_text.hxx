@@ -0,0 +1,57 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__SELECTED_TEXT__HXX
+#define COMMON__SELECTED_TEXT__HXX
+
+#include "terminol/common/deduper_interface.hxx"
+#include "terminol/support/pattern.hxx"
+
+#include <string>
+#include <vector>
+
+// SelectedText is a snapshot of a selection that is converted to UTF-8 a
+// piece at a time, so that copying a large selection neither stalls the
+// UI nor holds the whole text in memory. Its stored paragraphs are held by
+// tag, with a reference of their own, so the history may change meanwhile.
+class SelectedText : private Uncopyable {
+public:
+    // Where reading got to. Each reader of the text has its own.
+    struct Cursor {
+        size_t   index;         // Paragraph.
+        uint32_t offset;        // Cell within the paragraph.
+
+        Cursor(size_t index_, uint32_t offset_) : index(index_), offset(offset_) {}
+    };
+
+    // The paragraphs are 'tags' (already retained) followed by 'paras'.
+    // The selection begins at 'beginOffset' in the first and ends at
+    // 'endOffset' in the last, beyond which it includes the newline.
+    // 'cells' is the number of selected cells, a lower bound on the size.
+    SelectedText(I_Deduper                       & deduper,
+                 std::vector<I_Deduper::Tag>    && tags,
+                 std::vector<std::vector<Cell>> && paras,
+                 uint32_t                          beginOffset,
+                 uint32_t                          endOffset,
+                 size_t                            cells);
+
+    ~SelectedText();
+
+    Cursor begin() const { return Cursor(0, _beginOffset); }
+
+    // Append the text from 'cursor', stopping once 'text' has reached
+    // 'size' bytes. Return false if there was none left.
+    bool read(Cursor & cursor, std::string & text, size_t size) const;
+
+    size_t getCells() const { return _cells; }
+
+private:
+    I_Deduper                      & _deduper;
+    std::vector<I_Deduper::Tag>      _tags;
+    std::vector<std::vector<Cell>>   _paras;
+    uint32_t                         _beginOffset;
+    uint32_t                         _endOffset;
+    size_t                           _cells;
+};
+
+#endif // COMMON__SELECTED_TEXT__HXX
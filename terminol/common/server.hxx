@@ -7,10 +7,17 @@
 #include "terminol/common/config.hxx"
 #include "terminol/support/net.hxx"
 
+#include <cstring>
+
+// The first byte of a request to the server. EXPORT is followed by the
+// styles flag (a byte), the window id (4 bytes) and the path of the file.
+enum class Request : uint8_t { CREATE = 0, EXPORT = 1, SHUTDOWN = 0xFF };
+
 class I_Creator {
 public:
     virtual void create() = 0;
     virtual void shutdown() = 0;
+    virtual void exportHistory(uint32_t window, const std::string & path, bool styles) = 0;
 
 protected:
     I_Creator() {}
@@ -51,12 +58,24 @@ protected:
         //PRINT("Server connected: " << id);
     }
 
-    void serverReceived(int id, const uint8_t * data, size_t UNUSED(size)) override {
+    void serverReceived(int id, const uint8_t * data, size_t size) override {
         //PRINT("Server received bytes, " << id << ": " << size << "b");
 
-        if (data[0] == 0xFF) {
+        if (data[0] == static_cast<uint8_t>(Request::SHUTDOWN)) {
             _creator.shutdown();
         }
+        else if (data[0] == static_cast<uint8_t>(Request::EXPORT)) {
+            uint32_t window;
+
+            if (size > 2 + sizeof window) {
+                std::memcpy(&window, data + 2, sizeof window);
+                std::string path(data + 2 + sizeof window, data + size);
+                _creator.exportHistory(window, path, data[1] != 0);
+            }
+            else {
+                ERROR("Bad export request.");
+            }
+        }
         else {
             _creator.create();
         }
@@ -8,9 +8,26 @@
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <chrono>
+
+#include <zlib.h>
 
 namespace {
 
+// Encoded bytes packed into each block of the warm tier.
+const size_t BLOCK_SIZE = 64 * 1024;
+
+// Number of decompressed blocks kept for lookups.
+const size_t BLOCK_CACHE = 8;
+
+// Time between compaction passes. Entries that aren't stored or looked up
+// for a whole interval are moved to the warm tier.
+const std::chrono::seconds COMPACT_INTERVAL(10);
+
+// Number of imported entries indexed, or trigrams pruned, between releases
+// of the lock.
+const size_t INDEX_BATCH = 1024;
+
 void encode(const std::vector<Cell> & cells,
             std::vector<uint8_t>    & bytes) {
     OutMemoryStream os(bytes, true);
@@ -69,53 +86,116 @@ void decode(const std::vector<uint8_t> & bytes, std::vector<Cell> & cells) {
 
 } // namespace {anonymous}
 
-SimpleDeduper::SimpleDeduper() : _entries(), _totalRefs(0), _mutex() {}
+SimpleDeduper::SimpleDeduper(size_t memoryLimit, const std::string & spillDir, bool index) :
+    _entries(),
+    _blocks(),
+    _blockCache(),
+    _hotQueue(),
+    _spillQueue(),
+    _imports(),
+    _memoryLimit(memoryLimit),
+    _spillDir(spillDir),
+    _spillFile(),
+    _index(index ? new TrigramIndex : nullptr),
+    _unindexed(),
+    _indexRemovals(0),
+    _nextBlock(0),
+    _epoch(0),
+    _totalRefs(0),
+    _uniqueBytes(0),
+    _totalBytes(0),
+    _warmBytes(0),
+    _blockBytes(0),
+    _spillBytes(0),
+    _importBytes(0),
+    _hotLookups(0),
+    _warmLookups(0),
+    _hotNanos(0),
+    _warmNanos(0),
+    _finalised(false),
+    _mutex(),
+    _condition(),
+    _thread() {}
+
+SimpleDeduper::~SimpleDeduper() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finalised = true;
+        _condition.notify_all();
+    }
 
-SimpleDeduper::~SimpleDeduper() {}
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
 
 auto SimpleDeduper::store(const std::vector<Cell> & cells) -> Tag {
-    std::unique_lock<std::mutex> lock(_mutex);
-
+    // Encode and hash before taking the lock, so that concurrent lookups
+    // only wait on the map.
     std::vector<uint8_t> bytes;
     encode(cells, bytes);
     auto tag = makeTag(bytes);
 
-again:
-    ASSERT(tag != invalidTag(), "");
-    auto iter = _entries.find(tag);
-
-    if (iter == _entries.end()) {
-        _entries.insert(std::make_pair(tag, Entry(cells.size(), std::move(bytes))));
-    }
-    else {
-        auto & entry = iter->second;
+    std::vector<TrigramIndex::Gram> grams;
+    if (_index) { TrigramIndex::extract(cells, grams); }
 
-        if (bytes != entry.bytes) {
-            std::cerr << "Hash collision: " << tag << std::endl;
+    std::unique_lock<std::mutex> lock(_mutex);
 
-            ENFORCE(static_cast<Tag>(_entries.size()) != invalidTag(), "No dedupe room left.");
+    return insert(tag, cells.size(), std::move(bytes), grams);
+}
 
-            ++tag;
-            if (tag == invalidTag()) { ++tag; }
-            goto again;
-        }
+void SimpleDeduper::storeBatch(const std::vector<Cell> * const * cells, size_t count,
+                               Tag * tags) {
+    std::vector<std::vector<uint8_t>>            bytes(count);
+    std::vector<std::vector<TrigramIndex::Gram>> grams(count);
 
-        ++entry.refs;
+    for (size_t i = 0; i != count; ++i) {
+        encode(*cells[i], bytes[i]);
+        tags[i] = makeTag(bytes[i]);
+        if (_index) { TrigramIndex::extract(*cells[i], grams[i]); }
     }
 
-    ++_totalRefs;
+    std::unique_lock<std::mutex> lock(_mutex);
 
-    return tag;
+    for (size_t i = 0; i != count; ++i) {
+        tags[i] = insert(tags[i], cells[i]->size(), std::move(bytes[i]), grams[i]);
+    }
 }
 
 void SimpleDeduper::lookup(Tag tag, std::vector<Cell> & cells) const {
-    std::unique_lock<std::mutex> lock(_mutex);
+    auto start = std::chrono::steady_clock::now();
 
-    auto iter = _entries.find(tag);
-    ASSERT(iter != _entries.end(), "");
+    // Copy the bytes with the lock held and decode them without it, so that
+    // lookups from several threads (e.g. an Exporter's) proceed in parallel.
+    std::vector<uint8_t> bytes;
+    bool                 hot;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto iter = _entries.find(tag);
+        ASSERT(iter != _entries.end(), "");
+        auto & entry = iter->second;
+
+        hot = entry.block == HOT;
+
+        if (hot) {
+            bytes = entry.bytes;
+        }
+        else {
+            getBytes(entry, bytes);
+        }
+
+        entry.epoch = _epoch;
+    }
 
-    auto & bytes = iter->second.bytes;
     decode(bytes, cells);
+
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    countLookup(hot, nanos);
 }
 
 void SimpleDeduper::lookupSegment(Tag tag, uint32_t offset, int16_t max_size,
@@ -125,9 +205,8 @@ void SimpleDeduper::lookupSegment(Tag tag, uint32_t offset, int16_t max_size,
     auto iter = _entries.find(tag);
     ASSERT(iter != _entries.end(), "");
 
-    auto & bytes = iter->second.bytes;
     std::vector<Cell> tmp_cells;
-    decode(bytes, tmp_cells);
+    decodeEntry(iter->second, tmp_cells);
 
     cells.resize(max_size, Cell::blank());
     wrap = std::min<uint32_t>(max_size, tmp_cells.size() - offset);
@@ -148,16 +227,105 @@ size_t SimpleDeduper::lookupLength(Tag tag) const {
 void SimpleDeduper::remove(Tag tag) {
     std::unique_lock<std::mutex> lock(_mutex);
 
-    ASSERT(tag != invalidTag(), "");
+    release(tag, 1);
+}
+
+void SimpleDeduper::removeBatch(const Tag * tags, size_t count) {
+    // Sort a copy so that repeated tags are found once.
+    std::vector<Tag> sorted(tags, tags + count);
+    std::sort(sorted.begin(), sorted.end());
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (auto iter = sorted.begin(); iter != sorted.end(); ) {
+        auto next = std::upper_bound(iter, sorted.end(), *iter);
+        release(*iter, next - iter);
+        iter = next;
+    }
+}
+
+void SimpleDeduper::retainBatch(const Tag * tags, size_t count) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (size_t i = 0; i != count; ++i) {
+        auto iter = _entries.find(tags[i]);
+        ASSERT(iter != _entries.end(), "");
+        auto & entry = iter->second;
+
+        ++entry.refs;
+        _totalBytes += entry.size;
+    }
+
+    _totalRefs += count;
+}
+
+void SimpleDeduper::exportEntry(Tag tag, uint32_t & length, std::vector<uint8_t> & bytes) const {
+    std::unique_lock<std::mutex> lock(_mutex);
+
     auto iter = _entries.find(tag);
     ASSERT(iter != _entries.end(), "");
     auto & entry = iter->second;
 
-    if (--entry.refs == 0) {
-        _entries.erase(iter);
+    std::vector<uint8_t> scratch;
+    bytes  = getBytes(entry, scratch);
+    length = entry.length;
+}
+
+bool SimpleDeduper::importEntry(Tag tag, uint32_t length,
+                                const uint8_t * bytes, uint32_t size, uint32_t refs) {
+    ASSERT(tag != invalidTag() && refs != 0, "");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_entries.count(tag) != 0) {
+        return false;
     }
 
-    --_totalRefs;
+    Entry entry(length, std::vector<uint8_t>(), _epoch);
+    entry.refs   = refs;
+    entry.size   = size;
+    entry.block  = MAPPED;
+    entry.offset = _imports.size();
+
+    _imports.push_back(bytes);
+    _entries.insert(std::make_pair(tag, std::move(entry)));
+
+    if (_index) {
+        _unindexed.push_back(tag);
+    }
+
+    _totalRefs   += refs;
+    _uniqueBytes += size;
+    _totalBytes  += static_cast<size_t>(refs) * size;
+    _importBytes += size;
+
+    return true;
+}
+
+bool SimpleDeduper::findCandidates(const std::vector<std::string> & literals,
+                                   std::vector<Tag>               & tags) const {
+    if (!_index ||
+        std::none_of(literals.begin(), literals.end(),
+                     [](const std::string & literal) { return literal.size() >= 3; }))
+    {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (!_unindexed.empty()) {
+        // The index is incomplete until the imports have been indexed.
+        return false;
+    }
+
+    _index->find(literals, tags);
+
+    // Drop the removed entries that haven't been pruned yet.
+    tags.erase(std::remove_if(tags.begin(), tags.end(),
+                              [this](Tag tag) { return _entries.count(tag) == 0; }),
+               tags.end());
+
+    return true;
 }
 
 void SimpleDeduper::getLineStats(uint32_t & uniqueLines, uint32_t & totalLines) const {
@@ -170,17 +338,31 @@ void SimpleDeduper::getLineStats(uint32_t & uniqueLines, uint32_t & totalLines)
 void SimpleDeduper::getByteStats(size_t & uniqueBytes, size_t & totalBytes) const {
     std::unique_lock<std::mutex> lock(_mutex);
 
-    uniqueBytes = 0;
-    totalBytes = 0;
+    uniqueBytes = _uniqueBytes;
+    totalBytes  = _totalBytes;
+}
 
-    for (auto & l : _entries) {
-        auto & entry = l.second;
+size_t SimpleDeduper::getResidentBytes() const {
+    std::unique_lock<std::mutex> lock(_mutex);
 
-        size_t size = entry.bytes.size();
+    return countResidentBytes();
+}
 
-        uniqueBytes += size;
-        totalBytes  += entry.refs * size;
-    }
+void SimpleDeduper::getCompressionStats(size_t & rawBytes, size_t & compressedBytes) const {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    rawBytes        = _warmBytes;
+    compressedBytes = _blockBytes + _spillBytes;
+}
+
+void SimpleDeduper::getLookupStats(uint32_t & hotLookups, double & hotMicros,
+                                   uint32_t & warmLookups, double & warmMicros) const {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    hotLookups  = _hotLookups;
+    hotMicros   = _hotLookups  == 0 ? 0.0 : _hotNanos  / 1000.0 / _hotLookups;
+    warmLookups = _warmLookups;
+    warmMicros  = _warmLookups == 0 ? 0.0 : _warmNanos / 1000.0 / _warmLookups;
 }
 
 void SimpleDeduper::dump(std::ostream & UNUSED(ost)) const {
@@ -222,3 +404,483 @@ auto SimpleDeduper::makeTag(const std::vector<uint8_t> & bytes) -> Tag {
     if (tag == invalidTag()) { ++tag; }
     return tag;
 }
+
+auto SimpleDeduper::insert(Tag tag, uint32_t length, std::vector<uint8_t> && bytes,
+                           const std::vector<TrigramIndex::Gram> & grams) -> Tag {
+    if (!_thread.joinable()) {
+        // Not started until now, in case the server daemonises after
+        // constructing us.
+        _thread = std::thread(&SimpleDeduper::background, this);
+    }
+
+again:
+    ASSERT(tag != invalidTag(), "");
+    auto iter = _entries.find(tag);
+
+    if (iter == _entries.end()) {
+        _uniqueBytes += bytes.size();
+        _totalBytes  += bytes.size();
+        _entries.insert(std::make_pair(tag, Entry(length, std::move(bytes), _epoch)));
+        _hotQueue.push_back(tag);
+
+        if (_index) {
+            _index->add(tag, grams);
+        }
+    }
+    else {
+        auto & entry = iter->second;
+        std::vector<uint8_t> scratch;
+
+        if (bytes != getBytes(entry, scratch)) {
+            std::cerr << "Hash collision: " << tag << std::endl;
+
+            ENFORCE(static_cast<Tag>(_entries.size()) != invalidTag(), "No dedupe room left.");
+
+            ++tag;
+            if (tag == invalidTag()) { ++tag; }
+            goto again;
+        }
+
+        ++entry.refs;
+        entry.epoch  = _epoch;
+        _totalBytes += entry.size;
+
+        if (entry.block != HOT) {
+            promote(entry, std::move(bytes));
+            _hotQueue.push_back(tag);
+        }
+    }
+
+    ++_totalRefs;
+
+    return tag;
+}
+
+void SimpleDeduper::release(Tag tag, uint32_t refs) {
+    ASSERT(tag != invalidTag(), "");
+    auto iter = _entries.find(tag);
+    ASSERT(iter != _entries.end(), "");
+    auto & entry = iter->second;
+    ASSERT(entry.refs >= refs, "");
+
+    entry.refs  -= refs;
+    _totalBytes -= refs * entry.size;
+
+    if (entry.refs == 0) {
+        _uniqueBytes -= entry.size;
+
+        if (entry.block == MAPPED) {
+            _importBytes -= entry.size;
+        }
+        else if (entry.block != HOT) {
+            _warmBytes -= entry.size;
+            releaseBlock(entry.block, entry.size);
+        }
+
+        _entries.erase(iter);
+        ++_indexRemovals;
+    }
+
+    _totalRefs -= refs;
+}
+
+auto SimpleDeduper::getBytes(const Entry & entry,
+                             std::vector<uint8_t> & scratch) const -> const std::vector<uint8_t> & {
+    if (entry.block == HOT) {
+        return entry.bytes;
+    }
+    else if (entry.block == MAPPED) {
+        auto bytes = _imports[entry.offset];
+        scratch.assign(bytes, bytes + entry.size);
+        return scratch;
+    }
+    else {
+        auto & block = getBlock(entry.block);
+        scratch.assign(block.begin() + entry.offset, block.begin() + entry.offset + entry.size);
+        return scratch;
+    }
+}
+
+const std::vector<uint8_t> & SimpleDeduper::getBlock(uint32_t id) const {
+    auto iter = _blockCache.find(id);
+
+    if (iter == _blockCache.end()) {
+        auto blockIter = _blocks.find(id);
+        ASSERT(blockIter != _blocks.end(), "");
+        auto & block = blockIter->second;
+
+        auto data =
+            block.segment == RESIDENT ?
+            &block.data.front() :
+            _spillFile->read(block.segment, block.offset);
+
+        std::vector<uint8_t> bytes(block.size);
+        uLongf size   = block.size;
+        auto   result = uncompress(&bytes.front(), &size, data, block.length);
+        ENFORCE(result == Z_OK && size == block.size, "Corrupt history block: " << result);
+
+        while (_blockCache.size() >= BLOCK_CACHE) {
+            _blockCache.erase(_blockCache.begin());
+        }
+
+        iter = _blockCache.insert(id, std::move(bytes));
+    }
+
+    return iter->second;
+}
+
+void SimpleDeduper::decodeEntry(const Entry & entry, std::vector<Cell> & cells) const {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<uint8_t> scratch;
+    decode(getBytes(entry, scratch), cells);
+    entry.epoch = _epoch;
+
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    countLookup(entry.block == HOT, nanos);
+}
+
+void SimpleDeduper::countLookup(bool hot, uint64_t nanos) const {
+    if (hot) {
+        ++_hotLookups;
+        _hotNanos += nanos;
+    }
+    else {
+        ++_warmLookups;
+        _warmNanos += nanos;
+    }
+}
+
+void SimpleDeduper::promote(Entry & entry, std::vector<uint8_t> && bytes) {
+    ASSERT(entry.block != HOT, "");
+    ASSERT(bytes.size() == entry.size, "");
+
+    auto id = entry.block;
+
+    entry.block  = HOT;
+    entry.offset = 0;
+    entry.bytes  = std::move(bytes);
+
+    if (id == MAPPED) {
+        _importBytes -= entry.size;
+    }
+    else {
+        _warmBytes -= entry.size;
+        releaseBlock(id, entry.size);
+    }
+}
+
+void SimpleDeduper::releaseBlock(uint32_t id, uint32_t size) {
+    auto iter = _blocks.find(id);
+    ASSERT(iter != _blocks.end(), "");
+    auto & block = iter->second;
+    ASSERT(block.live != 0 && block.liveBytes >= size, "");
+
+    block.liveBytes -= size;
+
+    if (--block.live == 0) {
+        if (block.segment == RESIDENT) {
+            _blockBytes -= block.length;
+        }
+        else {
+            _spillBytes -= block.length;
+            _spillFile->release(block.segment, block.length);
+        }
+
+        _blocks.erase(iter);
+
+        auto cacheIter = _blockCache.find(id);
+        if (cacheIter != _blockCache.end()) {
+            _blockCache.erase(cacheIter);
+        }
+    }
+}
+
+size_t SimpleDeduper::countResidentBytes() const {
+    // Warm entries are counted at their compressed size. Spilled and
+    // MAPPED entries aren't counted.
+    return _uniqueBytes - _warmBytes - _importBytes + _blockBytes;
+}
+
+void SimpleDeduper::background() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _condition.wait_for(lock, COMPACT_INTERVAL, [this]{ return _finalised; });
+
+        if (_finalised) {
+            break;
+        }
+
+        compact(lock);
+    }
+}
+
+void SimpleDeduper::unpackSparse() {
+    std::vector<uint32_t> sparse;
+
+    for (auto & pair : _blocks) {
+        if (pair.second.liveBytes < pair.second.size / 2) {
+            sparse.push_back(pair.first);
+        }
+    }
+
+    for (auto id : sparse) {
+        // Copy, promoting the last live entry releases the block.
+        auto tags  = _blocks.find(id)->second.tags;
+        auto bytes = getBlock(id);
+
+        for (auto tag : tags) {
+            auto iter = _entries.find(tag);
+
+            if (iter != _entries.end() && iter->second.block == id) {
+                auto & entry = iter->second;
+                auto   begin = bytes.begin() + entry.offset;
+                promote(entry, std::vector<uint8_t>(begin, begin + entry.size));
+                _hotQueue.push_back(tag);
+            }
+        }
+    }
+}
+
+void SimpleDeduper::compact(std::unique_lock<std::mutex> & lock) {
+    ++_epoch;
+
+    // The unpacked entries keep their epochs, so are packed again below.
+    unpackSparse();
+
+    // Entries used since the previous pass are requeued, so visit each
+    // queued tag at most once.
+    auto remaining = _hotQueue.size();
+
+    while (remaining != 0 && !_finalised) {
+        // Gather cold entries until there's a block's worth.
+        std::vector<uint8_t>                   raw;
+        std::vector<std::pair<Tag, uint32_t>>  slices;      // Tag, size.
+
+        while (remaining != 0 && raw.size() < BLOCK_SIZE) {
+            auto tag = _hotQueue.front();
+            _hotQueue.pop_front();
+            --remaining;
+
+            auto iter = _entries.find(tag);
+
+            if (iter == _entries.end() || iter->second.block != HOT) {
+                // Removed or already warm.
+                continue;
+            }
+
+            auto & entry = iter->second;
+
+            if (entry.epoch + 1 >= _epoch) {
+                _hotQueue.push_back(tag);
+                continue;
+            }
+
+            slices.push_back(std::make_pair(tag, entry.size));
+            raw.insert(raw.end(), entry.bytes.begin(), entry.bytes.end());
+        }
+
+        if (slices.empty()) {
+            continue;
+        }
+
+        // Don't hold up lookups while compressing.
+        lock.unlock();
+        uLongf               size = compressBound(raw.size());
+        std::vector<uint8_t> data(size);
+        auto result = compress(&data.front(), &size, &raw.front(), raw.size());
+        lock.lock();
+
+        ENFORCE(result == Z_OK, "Failed to compress history block: " << result);
+        data.resize(size);
+        data.shrink_to_fit();
+
+        auto id = _nextBlock++;
+        if (_nextBlock == MAPPED) { _nextBlock = 0; }
+
+        Block    block = {
+            std::move(data), static_cast<uint32_t>(size), static_cast<uint32_t>(raw.size()),
+            0, 0, {}, RESIDENT, 0
+        };
+        uint32_t offset = 0;
+
+        // Move the entries that are unchanged and still cold.
+        for (auto & slice : slices) {
+            auto iter = _entries.find(slice.first);
+
+            if (iter != _entries.end()) {
+                auto & entry = iter->second;
+
+                if (entry.block == HOT && entry.epoch + 1 < _epoch &&
+                    entry.size == slice.second &&
+                    std::equal(entry.bytes.begin(), entry.bytes.end(), raw.begin() + offset))
+                {
+                    entry.block  = id;
+                    entry.offset = offset;
+                    std::vector<uint8_t>().swap(entry.bytes);
+                    _warmBytes  += entry.size;
+                    ++block.live;
+                    block.liveBytes += entry.size;
+                    block.tags.push_back(slice.first);
+                }
+            }
+
+            offset += slice.second;
+        }
+
+        if (block.live != 0) {
+            _blockBytes += block.length;
+            _blocks.insert(std::make_pair(id, std::move(block)));
+
+            if (_memoryLimit != 0) {
+                _spillQueue.push_back(id);
+            }
+        }
+    }
+
+    spill();
+
+    if (_index) {
+        indexImports(lock);
+        pruneIndex(lock);
+    }
+}
+
+void SimpleDeduper::spill() {
+    if (_memoryLimit == 0) {
+        return;
+    }
+
+    if (_spillFile) {
+        std::vector<uint32_t> sparse;
+        _spillFile->getSparse(sparse);
+
+        for (auto segment : sparse) {
+            // Copy, releasing the last block recycles the segment.
+            auto ids = _spillFile->getIds(segment);
+
+            for (auto id : ids) {
+                auto iter = _blocks.find(id);
+
+                if (iter != _blocks.end() && iter->second.segment == segment) {
+                    auto & block = iter->second;
+                    auto   data  = _spillFile->read(segment, block.offset);
+                    block.data.assign(data, data + block.length);
+                    block.segment = RESIDENT;
+
+                    _spillFile->release(segment, block.length);
+                    _spillBytes -= block.length;
+                    _blockBytes += block.length;
+                    _spillQueue.push_front(id);
+                }
+            }
+        }
+    }
+
+    while (countResidentBytes() > _memoryLimit && !_spillQueue.empty()) {
+        auto id   = _spillQueue.front();
+        auto iter = _blocks.find(id);
+
+        if (iter == _blocks.end() || iter->second.segment != RESIDENT) {
+            _spillQueue.pop_front();
+            continue;
+        }
+
+        auto & block = iter->second;
+
+        try {
+            if (!_spillFile) {
+                _spillFile.reset(new SpillFile(_spillDir));
+            }
+
+            if (_spillFile->append(block.data, id, block.segment, block.offset)) {
+                std::vector<uint8_t>().swap(block.data);
+                _blockBytes -= block.length;
+                _spillBytes += block.length;
+            }
+
+            _spillQueue.pop_front();
+        }
+        catch (const SpillFile::Error & error) {
+            // Try again on the next pass.
+            std::cerr << "Failed to spill history: " << error.message << std::endl;
+            break;
+        }
+    }
+}
+
+void SimpleDeduper::getSpillStats(size_t & spilledBytes, size_t & fileBytes) const {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    spilledBytes = _spillBytes;
+
+    if (_spillFile) {
+        size_t liveBytes;
+        _spillFile->getStats(liveBytes, fileBytes);
+    }
+    else {
+        fileBytes = 0;
+    }
+}
+
+void SimpleDeduper::indexImports(std::unique_lock<std::mutex> & lock) {
+    while (!_unindexed.empty() && !_finalised) {
+        // The batch stays queued until it is indexed, so that findCandidates()
+        // knows the index is incomplete. Imports are only ever appended.
+        auto count = std::min(_unindexed.size(), INDEX_BATCH);
+        std::vector<Tag>                  tags(_unindexed.begin(), _unindexed.begin() + count);
+        std::vector<std::vector<uint8_t>> bytes(count);
+
+        for (size_t i = 0; i != count; ++i) {
+            auto iter = _entries.find(tags[i]);
+
+            if (iter != _entries.end()) {
+                std::vector<uint8_t> scratch;
+                bytes[i] = getBytes(iter->second, scratch);
+            }
+        }
+
+        // Don't hold up lookups while decoding.
+        lock.unlock();
+        std::vector<std::vector<TrigramIndex::Gram>> grams(count);
+
+        for (size_t i = 0; i != count; ++i) {
+            if (!bytes[i].empty()) {
+                std::vector<Cell> cells;
+                decode(bytes[i], cells);
+                TrigramIndex::extract(cells, grams[i]);
+            }
+        }
+        lock.lock();
+
+        for (size_t i = 0; i != count; ++i) {
+            _index->add(tags[i], grams[i]);
+        }
+
+        _unindexed.erase(_unindexed.begin(), _unindexed.begin() + count);
+    }
+}
+
+void SimpleDeduper::pruneIndex(std::unique_lock<std::mutex> & lock) {
+    if (_indexRemovals <= _entries.size()) {
+        return;
+    }
+
+    _indexRemovals = 0;
+
+    std::vector<TrigramIndex::Gram> grams;
+    _index->getGrams(grams);
+
+    for (size_t i = 0; i != grams.size() && !_finalised; ++i) {
+        _index->prune(grams[i], [this](Tag tag) { return _entries.count(tag) != 0; });
+
+        if ((i + 1) % INDEX_BATCH == 0) {
+            // Let lookups in.
+            lock.unlock();
+            lock.lock();
+        }
+    }
+}
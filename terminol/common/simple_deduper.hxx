@@ -5,48 +5,158 @@
 #define COMMON__SIMPLE_DEDUPER__HXX
 
 #include "terminol/common/deduper_interface.hxx"
+#include "terminol/common/spill_file.hxx"
+#include "terminol/common/trigram_index.hxx"
+#include "terminol/support/cache.hxx"
 
 #include <unordered_map>
 #include <vector>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 
 //
 //
 //
 
+// Entries are held in two tiers. The hot tier holds each entry's encoded
+// bytes. A background pass moves entries that haven't been stored or
+// looked up recently into the warm tier, where they are packed together into
+// compressed blocks. Lookups of warm entries decompress the whole block,
+// keeping the most recent blocks in a small cache. Blocks that become mostly
+// dead as entries are removed are repacked.
+// Given a memory limit, the oldest blocks are spilled to a SpillFile
+// (the cold tier) while the resident history exceeds it.
+// Entries imported from a snapshot are read in place, from its mapping.
+// Optionally, the text of the entries is indexed by trigram for searching.
+// Imported entries are indexed by the background pass.
 class SimpleDeduper : public I_Deduper {
+    static const uint32_t HOT      = std::numeric_limits<uint32_t>::max();
+    static const uint32_t MAPPED   = std::numeric_limits<uint32_t>::max() - 1;
+    static const uint32_t RESIDENT = std::numeric_limits<uint32_t>::max();
+
     struct Entry {
         uint32_t             refs;
         uint32_t             length;
-        std::vector<uint8_t> bytes;
+        uint32_t             size;      // Of the encoded bytes.
+        uint32_t             block;     // HOT, MAPPED or the block holding the bytes.
+        uint32_t             offset;    // Into the decompressed block, or _imports if MAPPED.
+        mutable uint32_t     epoch;     // When last stored or looked up.
+        std::vector<uint8_t> bytes;     // Empty unless HOT.
+
+        Entry(uint32_t length_, std::vector<uint8_t> && bytes_, uint32_t epoch_) :
+            refs(1), length(length_), size(bytes_.size()), block(HOT), offset(0),
+            epoch(epoch_), bytes(std::move(bytes_)) {}
+    };
 
-        Entry(uint32_t length_, std::vector<uint8_t> && bytes_) :
-            refs(1), length(length_), bytes(bytes_) {}
+    struct Block {
+        std::vector<uint8_t> data;      // Compressed, empty unless RESIDENT.
+        uint32_t             length;    // Of the compressed data.
+        uint32_t             size;      // Decompressed.
+        uint32_t             live;      // Entries still held by the block.
+        uint32_t             liveBytes; // Their sizes.
+        std::vector<Tag>     tags;      // Of the entries originally packed.
+        uint32_t             segment;   // RESIDENT, or the spill file segment holding the data.
+        uint32_t             offset;    // Into the segment.
     };
 
-    std::unordered_map<Tag, Entry> _entries;
-    size_t                         _totalRefs;
-    mutable std::mutex             _mutex;
+    std::unordered_map<Tag, Entry>                        _entries;
+    std::unordered_map<uint32_t, Block>                   _blocks;
+    mutable Cache<uint32_t, std::vector<uint8_t>>         _blockCache;  // Decompressed.
+    std::deque<Tag>                                       _hotQueue;    // Oldest first.
+    std::deque<uint32_t>                                  _spillQueue;  // Resident blocks, oldest first.
+    std::vector<const uint8_t *>                          _imports;     // Bytes of the MAPPED entries.
+    size_t                                                _memoryLimit; // 0 -> unlimited.
+    std::string                                           _spillDir;
+    std::unique_ptr<SpillFile>                            _spillFile;
+    std::unique_ptr<TrigramIndex>                         _index;       // Null unless indexing.
+    std::deque<Tag>                                       _unindexed;   // Imported, oldest first.
+    size_t                                                _indexRemovals; // Since the last prune.
+    uint32_t                                              _nextBlock;
+    uint32_t                                              _epoch;       // Compaction passes.
+    size_t                                                _totalRefs;
+    size_t                                                _uniqueBytes; // Sum of the entry sizes.
+    size_t                                                _totalBytes;  // Sum of the entry sizes times refs.
+    size_t                                                _warmBytes;   // Sum of the warm entry sizes.
+    size_t                                                _blockBytes;  // Sum of the resident block lengths.
+    size_t                                                _spillBytes;  // Sum of the spilled block lengths.
+    size_t                                                _importBytes; // Sum of the MAPPED entry sizes.
+    mutable uint32_t                                      _hotLookups;
+    mutable uint32_t                                      _warmLookups;
+    mutable uint64_t                                      _hotNanos;
+    mutable uint64_t                                      _warmNanos;
+    bool                                                  _finalised;
+    mutable std::mutex                                    _mutex;
+    std::condition_variable                               _condition;
+    std::thread                                           _thread;      // Started by the first insert().
 
 public:
-    SimpleDeduper();
+    // Spill history to a file in 'spillDir' beyond 'memoryLimit' bytes,
+    // 0 means never. Keep a TrigramIndex if 'index'.
+    explicit SimpleDeduper(size_t memoryLimit = 0, const std::string & spillDir = std::string(),
+                           bool index = false);
     virtual ~SimpleDeduper();
 
     // I_Deduper implementation:
 
     Tag store(const std::vector<Cell> & cells) override;
+    void storeBatch(const std::vector<Cell> * const * cells, size_t count,
+                    Tag * tags) override;
     void lookup(Tag tag, std::vector<Cell> & cells) const override;
     void lookupSegment(Tag tag, uint32_t offset, int16_t maxSize,
                        std::vector<Cell> & cells, bool & cont, int16_t & wrap) const override;
     size_t lookupLength(Tag tag) const override;
     void remove(Tag tag) override;
+    void removeBatch(const Tag * tags, size_t count) override;
+    void retainBatch(const Tag * tags, size_t count) override;
+    void exportEntry(Tag tag, uint32_t & length, std::vector<uint8_t> & bytes) const override;
+    bool importEntry(Tag tag, uint32_t length,
+                     const uint8_t * bytes, uint32_t size, uint32_t refs) override;
+    bool findCandidates(const std::vector<std::string> & literals,
+                        std::vector<Tag>               & tags) const override;
 
     void getLineStats(uint32_t & uniqueLines, uint32_t & totalLines) const override;
     void getByteStats(size_t & uniqueBytes1, size_t & totalBytes) const override;
+    size_t getResidentBytes() const override;
+    void getCompressionStats(size_t & rawBytes, size_t & compressedBytes) const override;
+    void getLookupStats(uint32_t & hotLookups, double & hotMicros,
+                        uint32_t & warmLookups, double & warmMicros) const override;
+    void getSpillStats(size_t & spilledBytes, size_t & fileBytes) const override;
     void dump(std::ostream & ost) const override;
 
 protected:
     static Tag makeTag(const std::vector<uint8_t> & bytes);
+
+    void background();
+    void compact(std::unique_lock<std::mutex> & lock);
+
+    // These must be called with _mutex held.
+    size_t countResidentBytes() const;
+    // 'grams' are the trigrams of the entry, for the index.
+    Tag insert(Tag tag, uint32_t length, std::vector<uint8_t> && bytes,
+               const std::vector<TrigramIndex::Gram> & grams);
+    void release(Tag tag, uint32_t refs);
+    // Return the entry's bytes, decompressing them into 'scratch' if warm.
+    const std::vector<uint8_t> & getBytes(const Entry & entry,
+                                          std::vector<uint8_t> & scratch) const;
+    const std::vector<uint8_t> & getBlock(uint32_t id) const;
+    void decodeEntry(const Entry & entry, std::vector<Cell> & cells) const;
+    void countLookup(bool hot, uint64_t nanos) const;
+    // Return the entry to the hot tier with the given (matching) bytes.
+    void promote(Entry & entry, std::vector<uint8_t> && bytes);
+    void releaseBlock(uint32_t id, uint32_t size);
+    // Return the live entries of mostly dead blocks to the hot tier, to be
+    // packed again.
+    void unpackSparse();
+    // Spill the oldest blocks while over the memory limit, first bringing
+    // back the blocks of sparse segments so that they are spilled compactly.
+    void spill();
+    // Index the imported entries, a batch at a time.
+    void indexImports(std::unique_lock<std::mutex> & lock);
+    // Prune the index once most of the entries it has seen are gone.
+    void pruneIndex(std::unique_lock<std::mutex> & lock);
 };
 
 #endif // COMMON__SIMPLE_DEDUPER__HXX
@@ -0,0 +1,652 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/snapshot.hxx"
+#include "terminol/support/debug.hxx"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char     MAGIC[8]       = { 't', 'e', 'r', 'm', 'h', 'i', 's', 't' };
+const uint32_t FORMAT_VERSION = 2;
+
+enum RecordType : uint32_t { ENTRIES = 1, WINDOW = 2, COMMIT = 3 };
+
+struct FileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t tagSize;
+};
+
+struct RecordHeader {
+    uint32_t type;
+    uint32_t count;
+    uint64_t size;          // Of the payload that follows.
+};
+
+struct WindowHeader {
+    uint32_t key;
+    uint32_t dropFront;
+    uint32_t dropBack;      // Tags, before appending.
+};
+
+struct DirEntry {
+    I_Deduper::Tag tag;
+    uint32_t       length;  // Cells.
+    uint32_t       size;    // Encoded bytes.
+};
+
+// Most entries written per ENTRIES record.
+const size_t ENTRIES_CHUNK = 4096;
+
+// The file is rewritten once it holds more than twice as many entries as
+// the windows refer to, plus this many.
+const size_t REWRITE_SLACK = 4096;
+
+bool writeAll(int fd, const void * data, size_t size) {
+    auto bytes = static_cast<const uint8_t *>(data);
+
+    while (size != 0) {
+        auto rval = TEMP_FAILURE_RETRY(::write(fd, bytes, size));
+
+        if (rval == -1) {
+            return false;
+        }
+
+        bytes += rval;
+        size  -= rval;
+    }
+
+    return true;
+}
+
+} // namespace {anonymous}
+
+SnapshotWriter::SnapshotWriter(const std::string                 & path,
+                               I_Deduper                         & deduper,
+                               const std::vector<I_Deduper::Tag> & written) :
+    _path(path),
+    _deduper(deduper),
+    _written(),
+    _unused(written.size()),
+    _windows(),
+    _nextKey(0),
+    _job(),
+    _fd(-1),
+    _rewrite(true),         // The existing file may have a torn tail.
+    _finalised(false),
+    _mutex(),
+    _condition(),
+    _thread(&SnapshotWriter::background, this)
+{
+    for (auto tag : written) {
+        _written.insert(std::make_pair(tag, 0));
+    }
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finalised = true;
+        _condition.notify_all();
+    }
+
+    _thread.join();
+
+    if (_fd != -1) {
+        ENFORCE_SYS(TEMP_FAILURE_RETRY(::close(_fd)) != -1, "");
+    }
+}
+
+uint32_t SnapshotWriter::getNext(uint32_t id) const {
+    auto iter = _windows.find(id);
+
+    if (iter == _windows.end()) {
+        return 0;
+    }
+
+    auto & state = iter->second;
+    return static_cast<uint32_t>(state.first + state.tags.size());
+}
+
+void SnapshotWriter::remove(uint32_t id) {
+    auto iter = _windows.find(id);
+
+    if (iter != _windows.end()) {
+        removeUses(iter->second);
+        _windows.erase(iter);
+    }
+}
+
+void SnapshotWriter::checkpoint(std::vector<Window> && windows) {
+    std::unique_ptr<Job>        job(new Job());
+    std::vector<Record>         records;
+    std::vector<I_Deduper::Tag> retain;     // New entries of stored history.
+    std::vector<I_Deduper::Tag> extra;      // Surplus references from storing.
+
+    for (auto & pair : _windows) {
+        pair.second.seen = false;
+    }
+
+    for (auto & window : windows) {
+        auto iter = _windows.find(window.id);
+
+        if (iter == _windows.end()) {
+            iter = _windows.insert(std::make_pair(window.id, State(_nextKey++, window.lost))).first;
+        }
+
+        auto & state = iter->second;
+        ASSERT(!state.seen, "Duplicate window.");
+        state.seen = true;
+
+        Record record;
+        record.key = state.key;
+
+        // Drop the paragraphs lost since the previous checkpoint, and the
+        // unstored ones, which have since been stored or changed.
+        auto drop = std::min<size_t>(window.lost - state.first, state.tags.size());
+
+        for (size_t i = 0; i != drop; ++i) {
+            removeUse(state.tags.front());
+            state.tags.pop_front();
+        }
+
+        state.first      = window.lost;
+        record.dropFront = drop;
+        record.dropBack  = state.tail.size();
+
+        for (auto tag : state.tail) {
+            removeUse(tag);
+        }
+
+        state.tail.clear();
+
+        for (auto tag : window.tags) {
+            if (addUse(tag)) {
+                retain.push_back(tag);
+            }
+
+            state.tags.push_back(tag);
+        }
+
+        // Store the unstored history, keeping the references of new entries.
+        for (auto & para : window.paras) {
+            auto tag = _deduper.store(para);
+
+            if (addUse(tag)) {
+                job->entries.push_back(tag);
+            }
+            else {
+                extra.push_back(tag);
+            }
+
+            state.tail.push_back(tag);
+        }
+
+        record.tags = std::move(window.tags);
+        record.tags.insert(record.tags.end(), state.tail.begin(), state.tail.end());
+        records.push_back(std::move(record));
+    }
+
+    // Windows without a record are gone.
+    for (auto iter = _windows.begin(); iter != _windows.end(); ) {
+        if (iter->second.seen) {
+            ++iter;
+        }
+        else {
+            removeUses(iter->second);
+            iter = _windows.erase(iter);
+        }
+    }
+
+    if (!retain.empty()) {
+        _deduper.retainBatch(&retain.front(), retain.size());
+        job->entries.insert(job->entries.end(), retain.begin(), retain.end());
+    }
+
+    if (!extra.empty()) {
+        _deduper.removeBatch(&extra.front(), extra.size());
+    }
+
+    job->checkpoints.push_back(std::move(records));
+
+    if (_unused > _written.size() - _unused + REWRITE_SLACK) {
+        // Drop the entries that are no longer referenced.
+        for (auto iter = _written.begin(); iter != _written.end(); ) {
+            if (iter->second == 0) {
+                job->released.push_back(iter->first);
+                iter = _written.erase(iter);
+            }
+            else {
+                ++iter;
+            }
+        }
+
+        _unused      = 0;
+        job->rewrite = true;
+    }
+    else {
+        job->rewrite = false;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_job) {
+        // The pending checkpoints haven't been started, write them first.
+        job->released.insert(job->released.end(),
+                             _job->released.begin(), _job->released.end());
+        job->rewrite = job->rewrite || _job->rewrite;
+        job->entries.insert(job->entries.begin(),
+                            _job->entries.begin(), _job->entries.end());
+        job->checkpoints.insert(job->checkpoints.begin(),
+                                std::make_move_iterator(_job->checkpoints.begin()),
+                                std::make_move_iterator(_job->checkpoints.end()));
+    }
+
+    if (job->rewrite || _rewrite) {
+        // Start the file again, with the windows in full.
+        job->rewrite = true;
+        job->entries.clear();
+        job->checkpoints.assign(1, std::vector<Record>());
+
+        for (auto & pair : _written) {
+            job->entries.push_back(pair.first);
+        }
+
+        for (auto & pair : _windows) {
+            auto & state = pair.second;
+
+            Record record;
+            record.key       = state.key;
+            record.dropFront = 0;
+            record.dropBack  = 0;
+            record.tags.assign(state.tags.begin(), state.tags.end());
+            record.tags.insert(record.tags.end(), state.tail.begin(), state.tail.end());
+            job->checkpoints.back().push_back(std::move(record));
+        }
+    }
+
+    _job = std::move(job);
+    _condition.notify_all();
+}
+
+bool SnapshotWriter::addUse(I_Deduper::Tag tag) {
+    auto result = _written.insert(std::make_pair(tag, 1));
+
+    if (result.second) {
+        return true;
+    }
+
+    if (result.first->second++ == 0) {
+        --_unused;
+    }
+
+    return false;
+}
+
+void SnapshotWriter::removeUse(I_Deduper::Tag tag) {
+    auto iter = _written.find(tag);
+    ASSERT(iter != _written.end() && iter->second != 0, "Unused entry.");
+
+    if (--iter->second == 0) {
+        ++_unused;
+    }
+}
+
+void SnapshotWriter::removeUses(State & state) {
+    for (auto tag : state.tags) {
+        removeUse(tag);
+    }
+
+    for (auto tag : state.tail) {
+        removeUse(tag);
+    }
+}
+
+void SnapshotWriter::background() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _condition.wait(lock, [this]{ return _finalised || _job; });
+
+        // Finish the pending checkpoint before exiting.
+        if (!_job) {
+            break;
+        }
+
+        std::unique_ptr<Job> job(std::move(_job));
+
+        lock.unlock();
+        auto written = write(*job);
+
+        if (!job->released.empty()) {
+            _deduper.removeBatch(&job->released.front(), job->released.size());
+        }
+        lock.lock();
+
+        if (!written) {
+            _rewrite = true;
+        }
+        else if (job->rewrite) {
+            _rewrite = false;
+        }
+    }
+}
+
+bool SnapshotWriter::write(const Job & job) {
+    auto tmpPath = _path + ".tmp";
+
+    if (job.rewrite) {
+        if (_fd != -1) {
+            ENFORCE_SYS(TEMP_FAILURE_RETRY(::close(_fd)) != -1, "");
+        }
+
+        _fd = TEMP_FAILURE_RETRY(::open(tmpPath.c_str(),
+                                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+
+        if (_fd == -1) {
+            std::cerr << "Failed to create " << tmpPath << ": " << ::strerror(errno) << std::endl;
+            return false;
+        }
+
+        FileHeader header;
+        std::memcpy(header.magic, MAGIC, sizeof MAGIC);
+        header.version = FORMAT_VERSION;
+        header.tagSize = sizeof(I_Deduper::Tag);
+
+        if (!writeAll(_fd, &header, sizeof header)) {
+            goto fail;
+        }
+    }
+    else if (_fd == -1) {
+        // A previous checkpoint failed, wait for a rewrite.
+        return false;
+    }
+
+    if (!writeEntries(job.entries)) {
+        goto fail;
+    }
+
+    for (auto & records : job.checkpoints) {
+        for (auto & record : records) {
+            WindowHeader header;
+            header.key       = record.key;
+            header.dropFront = record.dropFront;
+            header.dropBack  = record.dropBack;
+
+            if (!writeRecord(WINDOW, record.tags.size(), &header, sizeof header,
+                             record.tags.data(), record.tags.size() * sizeof(I_Deduper::Tag)))
+            {
+                goto fail;
+            }
+        }
+
+        if (!writeRecord(COMMIT, 0, nullptr, 0)) {
+            goto fail;
+        }
+    }
+
+    if (TEMP_FAILURE_RETRY(::fdatasync(_fd)) == -1) {
+        goto fail;
+    }
+
+    if (job.rewrite && ::rename(tmpPath.c_str(), _path.c_str()) == -1) {
+        goto fail;
+    }
+
+    return true;
+
+fail:
+    std::cerr << "Failed to write " << _path << ": " << ::strerror(errno) << std::endl;
+    ENFORCE_SYS(TEMP_FAILURE_RETRY(::close(_fd)) != -1, "");
+    _fd = -1;
+    return false;
+}
+
+bool SnapshotWriter::writeEntries(const std::vector<I_Deduper::Tag> & tags) {
+    std::vector<DirEntry> directory;
+    std::vector<uint8_t>  bytes;
+    std::vector<uint8_t>  encoded;
+
+    for (size_t i = 0; i != tags.size(); ++i) {
+        DirEntry entry;
+        entry.tag = tags[i];
+        _deduper.exportEntry(entry.tag, entry.length, encoded);
+        entry.size = encoded.size();
+
+        directory.push_back(entry);
+        bytes.insert(bytes.end(), encoded.begin(), encoded.end());
+
+        if (directory.size() == ENTRIES_CHUNK || i + 1 == tags.size()) {
+            if (!writeRecord(ENTRIES, directory.size(),
+                             directory.data(), directory.size() * sizeof(DirEntry),
+                             bytes.data(), bytes.size()))
+            {
+                return false;
+            }
+
+            directory.clear();
+            bytes.clear();
+        }
+    }
+
+    return true;
+}
+
+bool SnapshotWriter::writeRecord(uint32_t type, uint32_t count,
+                                 const void * data1, size_t size1,
+                                 const void * data2, size_t size2) {
+    RecordHeader header;
+    header.type  = type;
+    header.count = count;
+    header.size  = size1 + size2;
+
+    return
+        writeAll(_fd, &header, sizeof header) &&
+        writeAll(_fd, data1, size1) &&
+        writeAll(_fd, data2, size2);
+}
+
+//
+//
+//
+
+SnapshotReader::SnapshotReader(const std::string & path) throw (Error) :
+    _map(nullptr),
+    _size(0),
+    _entries(),
+    _windows()
+{
+    auto fd = TEMP_FAILURE_RETRY(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+
+    if (fd == -1) {
+        throw Error("Failed to open " + path + ": " + std::string(::strerror(errno)));
+    }
+
+    struct stat st;
+    ENFORCE_SYS(::fstat(fd, &st) != -1, "");
+    _size = st.st_size;
+
+    if (_size < sizeof(FileHeader)) {
+        ENFORCE_SYS(TEMP_FAILURE_RETRY(::close(fd)) != -1, "");
+        throw Error("Truncated snapshot: " + path);
+    }
+
+    // The writer never modifies a file in place once it has been renamed
+    // into position, so the mapping stays valid.
+    auto map = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+    ENFORCE_SYS(TEMP_FAILURE_RETRY(::close(fd)) != -1, "");
+
+    if (map == MAP_FAILED) {
+        throw Error("Failed to map " + path + ": " + std::string(::strerror(errno)));
+    }
+
+    _map = static_cast<const uint8_t *>(map);
+
+    FileHeader header;
+    std::memcpy(&header, _map, sizeof header);
+
+    if (std::memcmp(header.magic, MAGIC, sizeof MAGIC) != 0 ||
+        header.version != FORMAT_VERSION ||
+        header.tagSize != sizeof(I_Deduper::Tag))
+    {
+        ENFORCE_SYS(::munmap(const_cast<uint8_t *>(_map), _size) != -1, "");
+        throw Error("Unrecognised snapshot: " + path);
+    }
+
+    // Read the records up to the first incomplete one. The changes of a
+    // checkpoint only count once its COMMIT has been read.
+    struct Change {
+        WindowHeader    header;
+        const uint8_t * tags;
+        uint32_t        count;
+    };
+
+    std::map<uint32_t, std::deque<I_Deduper::Tag>> windows;    // By key.
+    std::vector<Change>                            changes;
+    size_t offset = sizeof header;
+
+    while (offset + sizeof(RecordHeader) <= _size) {
+        RecordHeader record;
+        std::memcpy(&record, _map + offset, sizeof record);
+        offset += sizeof record;
+
+        if (record.size > _size - offset) {
+            break;
+        }
+
+        auto data  = _map + offset;
+        bool valid = true;
+
+        switch (record.type) {
+            case ENTRIES: {
+                uint64_t directorySize = static_cast<uint64_t>(record.count) * sizeof(DirEntry);
+                valid = directorySize <= record.size;
+
+                auto bytes     = data + directorySize;
+                auto remaining = record.size - directorySize;
+
+                for (uint32_t i = 0; valid && i != record.count; ++i) {
+                    DirEntry entry;
+                    std::memcpy(&entry, data + i * sizeof entry, sizeof entry);
+                    valid = entry.size <= remaining;
+
+                    if (valid) {
+                        _entries[entry.tag] = Entry{ bytes, entry.size, entry.length };
+                        bytes     += entry.size;
+                        remaining -= entry.size;
+                    }
+                }
+                break;
+            }
+            case WINDOW:
+                valid = sizeof(WindowHeader) +
+                    static_cast<uint64_t>(record.count) * sizeof(I_Deduper::Tag) == record.size;
+
+                if (valid) {
+                    Change change;
+                    std::memcpy(&change.header, data, sizeof change.header);
+                    change.tags  = data + sizeof change.header;
+                    change.count = record.count;
+                    changes.push_back(change);
+                }
+                break;
+            case COMMIT: {
+                std::map<uint32_t, std::deque<I_Deduper::Tag>> next;
+
+                for (auto & change : changes) {
+                    auto iter = next.find(change.header.key);
+
+                    if (iter == next.end()) {
+                        auto & tags = windows[change.header.key];
+                        iter = next.insert(std::make_pair(change.header.key, std::move(tags))).first;
+                    }
+
+                    auto & tags = iter->second;
+                    tags.erase(tags.begin(), tags.begin() +
+                               std::min<size_t>(change.header.dropFront, tags.size()));
+                    tags.erase(tags.end() -
+                               std::min<size_t>(change.header.dropBack, tags.size()), tags.end());
+
+                    for (uint32_t i = 0; i != change.count; ++i) {
+                        I_Deduper::Tag tag;
+                        std::memcpy(&tag, change.tags + i * sizeof tag, sizeof tag);
+                        tags.push_back(tag);
+                    }
+                }
+
+                // The windows without changes are gone.
+                windows.swap(next);
+                changes.clear();
+                break;
+            }
+            default:
+                valid = false;
+                break;
+        }
+
+        if (!valid) {
+            break;
+        }
+
+        offset += record.size;
+    }
+
+    for (auto & pair : windows) {
+        _windows.emplace_back(pair.second.begin(), pair.second.end());
+    }
+}
+
+SnapshotReader::~SnapshotReader() {
+    ENFORCE_SYS(::munmap(const_cast<uint8_t *>(_map), _size) != -1, "");
+}
+
+void SnapshotReader::restore(I_Deduper                                & deduper,
+                             std::deque<std::vector<I_Deduper::Tag>>  & windows,
+                             std::vector<I_Deduper::Tag>              & written) {
+    std::unordered_map<I_Deduper::Tag, uint32_t> refs;
+
+    for (auto & tags : _windows) {
+        for (auto tag : tags) {
+            ++refs[tag];
+        }
+    }
+
+    for (auto & pair : refs) {
+        auto iter = _entries.find(pair.first);
+
+        if (iter != _entries.end() &&
+            deduper.importEntry(pair.first, iter->second.length,
+                                iter->second.bytes, iter->second.size, pair.second + 1))
+        {
+            written.push_back(pair.first);
+        }
+        else {
+            std::cerr << "Missing snapshot entry: " << pair.first << std::endl;
+            pair.second = 0;
+        }
+    }
+
+    for (auto & tags : _windows) {
+        std::vector<I_Deduper::Tag> restored;
+
+        for (auto tag : tags) {
+            if (refs[tag] != 0) {
+                restored.push_back(tag);
+            }
+        }
+
+        windows.push_back(std::move(restored));
+    }
+
+    _windows.clear();
+}
@@ -0,0 +1,154 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__SNAPSHOT__HXX
+#define COMMON__SNAPSHOT__HXX
+
+#include "terminol/common/deduper_interface.hxx"
+#include "terminol/support/pattern.hxx"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// A snapshot persists the history of a server's windows so that it survives
+// a restart. The file is a header followed by records:
+//   ENTRIES - a directory of deduper entries (tag, length, size), followed
+//             by their encoded bytes.
+//   WINDOW  - a change to one window's history: the number of tags to drop
+//             from the front and from the back, followed by the tags to
+//             append. A window's first record starts from nothing.
+//   COMMIT  - ends a checkpoint, making its WINDOW records current. Windows
+//             without a record in the checkpoint are gone.
+// Each checkpoint appends only the entries that are new since the previous
+// one, and only the changes to the windows. The file is rewritten when most
+// of the entries it holds are no longer referenced. A checkpoint that was
+// cut short (e.g. by a crash) is ignored.
+
+// SnapshotWriter takes checkpoints, writing them on a background thread.
+// It keeps a deduper reference to each entry it has written, so that the
+// tag can't come to mean anything else while the file refers to it.
+class SnapshotWriter : private Uncopyable {
+public:
+    struct Window {
+        uint32_t                       id;      // The caller's, unique among the windows.
+        uint32_t                       lost;    // Paragraphs dropped from the front so far.
+        std::vector<I_Deduper::Tag>    tags;    // Stored history from getNext(id) on.
+        std::vector<std::vector<Cell>> paras;   // Unstored history that follows.
+    };
+
+private:
+    // What the file holds of a window's history.
+    struct State {
+        State(uint32_t key_, uint32_t first_) : key(key_), first(first_), tags(), tail(), seen(false) {}
+
+        uint32_t                    key;    // Of the window's records.
+        uint32_t                    first;  // Number of the paragraph of tags.front().
+        std::deque<I_Deduper::Tag>  tags;   // Stored history.
+        std::vector<I_Deduper::Tag> tail;   // Unstored history, stored for the file.
+        bool                        seen;   // In the current checkpoint?
+    };
+
+    struct Record {
+        uint32_t                    key;
+        uint32_t                    dropFront;
+        uint32_t                    dropBack;
+        std::vector<I_Deduper::Tag> tags;   // To append.
+    };
+
+    struct Job {
+        std::vector<I_Deduper::Tag>      entries;       // To write.
+        std::vector<std::vector<Record>> checkpoints;   // Each followed by a COMMIT.
+        std::vector<I_Deduper::Tag>      released;      // To remove once written.
+        bool                             rewrite;
+    };
+
+    const std::string                            _path;
+    I_Deduper                                  & _deduper;
+    std::unordered_map<I_Deduper::Tag, uint32_t> _written;  // Uses by _windows. UI thread only.
+    size_t                                       _unused;   // Entries of _written with no uses.
+    std::map<uint32_t, State>                    _windows;  // By id. UI thread only.
+    uint32_t                                     _nextKey;
+    std::unique_ptr<Job>                         _job;      // Pending.
+    int                                          _fd;       // Writer thread only.
+    bool                                         _rewrite;  // Is the file unusable for appending?
+    bool                                         _finalised;
+    std::mutex                                   _mutex;
+    std::condition_variable                      _condition;
+    std::thread                                  _thread;
+
+public:
+    // 'written' are entries already held by the file at 'path', with a
+    // reference taken for the writer.
+    SnapshotWriter(const std::string                 & path,
+                   I_Deduper                         & deduper,
+                   const std::vector<I_Deduper::Tag> & written);
+    ~SnapshotWriter();
+
+    // The number of the first stored paragraph of window 'id' that the file
+    // doesn't hold, 0 for a window it doesn't know. See Buffer::getHistory().
+    uint32_t getNext(uint32_t id) const;
+
+    // Forget window 'id', which has gone, so that the id may be reused.
+    void remove(uint32_t id);
+
+    // Replace the previous checkpoint with these windows.
+    void checkpoint(std::vector<Window> && windows);
+
+protected:
+    // Count a use of an entry by a window, returning true if it is new.
+    bool addUse(I_Deduper::Tag tag);
+    void removeUse(I_Deduper::Tag tag);
+    void removeUses(State & state);
+
+    void background();
+    bool write(const Job & job);
+    bool writeEntries(const std::vector<I_Deduper::Tag> & tags);
+    bool writeRecord(uint32_t type, uint32_t count,
+                     const void * data1, size_t size1,
+                     const void * data2 = nullptr, size_t size2 = 0);
+};
+
+// SnapshotReader maps a snapshot and reads the last complete checkpoint.
+// Only the record headers and entry directories are read up front; entry
+// bytes are paged in as the deduper looks them up, so the reader must
+// outlive the deduper.
+class SnapshotReader : private Uncopyable {
+public:
+    struct Error {
+        explicit Error(const std::string & message_) : message(message_) {}
+        std::string message;
+    };
+
+private:
+    struct Entry {
+        const uint8_t * bytes;
+        uint32_t        size;
+        uint32_t        length;
+    };
+
+    const uint8_t                                * _map;
+    size_t                                         _size;
+    std::unordered_map<I_Deduper::Tag, Entry>      _entries;
+    std::vector<std::vector<I_Deduper::Tag>>       _windows;    // Oldest first.
+
+public:
+    explicit SnapshotReader(const std::string & path) throw (Error);
+    ~SnapshotReader();
+
+    // Import the entries referenced by the windows into the deduper, with a
+    // reference for each use plus one for the SnapshotWriter. Windows takes
+    // the histories, whose references are owned by the caller; written
+    // takes the imported tags.
+    void restore(I_Deduper                                & deduper,
+                 std::deque<std::vector<I_Deduper::Tag>>  & windows,
+                 std::vector<I_Deduper::Tag>              & written);
+};
+
+#endif // COMMON__SNAPSHOT__HXX
@@ -0,0 +1,164 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/spill_file.hxx"
+#include "terminol/support/debug.hxx"
+#include "terminol/support/sys.hxx"
+
+#include <limits>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+namespace {
+
+const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+} // namespace {anonymous}
+
+SpillFile::SpillFile(const std::string & dir) throw (Error) :
+    _fd(-1),
+    _segments(),
+    _free(),
+    _current(NONE),
+    _liveBytes(0)
+{
+    auto path = dir + "/terminol-history-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+
+    _fd = ::mkstemp(&name.front());
+
+    if (_fd == -1) {
+        throw Error("Failed to create " + path + ": " + std::string(::strerror(errno)));
+    }
+
+    fdCloseExec(_fd);
+    ENFORCE_SYS(::unlink(&name.front()) != -1, "");
+}
+
+SpillFile::~SpillFile() {
+    for (auto & segment : _segments) {
+        ENFORCE_SYS(::munmap(segment.map, SEGMENT_SIZE) != -1, "");
+    }
+
+    ENFORCE_SYS(TEMP_FAILURE_RETRY(::close(_fd)) != -1, "");
+}
+
+bool SpillFile::append(const std::vector<uint8_t> & data, uint32_t id,
+                       uint32_t & segment, uint32_t & offset) throw (Error) {
+    if (data.size() > SEGMENT_SIZE) {
+        return false;
+    }
+
+    if (_current == NONE || _segments[_current].used + data.size() > SEGMENT_SIZE) {
+        auto previous = allocate();
+        std::swap(previous, _current);
+
+        if (previous != NONE && _segments[previous].live == 0) {
+            recycle(previous);
+        }
+    }
+
+    auto & current = _segments[_current];
+    std::memcpy(current.map + current.used, &data.front(), data.size());
+
+    segment = _current;
+    offset  = current.used;
+
+    current.used += data.size();
+    current.live += data.size();
+    current.ids.push_back(id);
+    _liveBytes   += data.size();
+
+    return true;
+}
+
+const uint8_t * SpillFile::read(uint32_t segment, uint32_t offset) const {
+    ASSERT(segment < _segments.size(), "");
+    ASSERT(offset < _segments[segment].used, "");
+    return _segments[segment].map + offset;
+}
+
+void SpillFile::release(uint32_t segment, uint32_t length) {
+    ASSERT(segment < _segments.size(), "");
+    auto & s = _segments[segment];
+    ASSERT(s.live >= length, "");
+
+    s.live     -= length;
+    _liveBytes -= length;
+
+    if (s.live == 0 && segment != _current) {
+        recycle(segment);
+    }
+}
+
+void SpillFile::getSparse(std::vector<uint32_t> & segments) const {
+    for (uint32_t i = 0; i != _segments.size(); ++i) {
+        auto & s = _segments[i];
+
+        if (i != _current && s.used != 0 && s.live < s.used / 2) {
+            segments.push_back(i);
+        }
+    }
+}
+
+const std::vector<uint32_t> & SpillFile::getIds(uint32_t segment) const {
+    ASSERT(segment < _segments.size(), "");
+    return _segments[segment].ids;
+}
+
+void SpillFile::getStats(size_t & liveBytes, size_t & fileBytes) const {
+    liveBytes = _liveBytes;
+    fileBytes = (_segments.size() - _free.size()) * static_cast<size_t>(SEGMENT_SIZE);
+}
+
+uint32_t SpillFile::allocate() throw (Error) {
+    uint32_t segment;
+
+    if (_free.empty()) {
+        segment = _segments.size();
+    }
+    else {
+        segment = _free.back();
+    }
+
+    // Reserve the disk space now. Running out of it while writing through
+    // the mapping would raise SIGBUS.
+    auto result = ::posix_fallocate(_fd, static_cast<off_t>(segment) * SEGMENT_SIZE, SEGMENT_SIZE);
+
+    if (result != 0) {
+        throw Error("Failed to extend history file: " + std::string(::strerror(result)));
+    }
+
+    if (_free.empty()) {
+        auto map = ::mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          _fd, static_cast<off_t>(segment) * SEGMENT_SIZE);
+        ENFORCE_SYS(map != MAP_FAILED, "");
+
+        _segments.push_back(Segment{ static_cast<uint8_t *>(map), 0, 0, {} });
+    }
+    else {
+        _free.pop_back();
+    }
+
+    return segment;
+}
+
+void SpillFile::recycle(uint32_t segment) {
+    auto & s = _segments[segment];
+    ASSERT(s.live == 0, "");
+
+    s.used = 0;
+    s.ids.clear();
+    _free.push_back(segment);
+
+#ifdef __linux__
+    // Return the disk space, ignoring file systems that can't.
+    ::fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                static_cast<off_t>(segment) * SEGMENT_SIZE, SEGMENT_SIZE);
+#endif
+}
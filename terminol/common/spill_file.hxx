@@ -0,0 +1,67 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__SPILL_FILE__HXX
+#define COMMON__SPILL_FILE__HXX
+
+#include "terminol/support/pattern.hxx"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// SpillFile is an append-only scratch file, accessed through mmap, that
+// holds history moved out of memory. The file is unlinked as soon as it is
+// created, so nothing is left behind.
+// The file is divided into fixed size segments. Records are appended to
+// the current segment and released individually; a segment is recycled when
+// nothing in it remains live. The caller compacts a sparse segment by
+// reading its live records back and releasing them.
+class SpillFile : private Uncopyable {
+public:
+    static const uint32_t SEGMENT_SIZE = 4 * 1024 * 1024;
+
+    struct Error {
+        explicit Error(const std::string & message_) : message(message_) {}
+        std::string message;
+    };
+
+private:
+    struct Segment {
+        uint8_t             * map;
+        uint32_t              used;
+        uint32_t              live;
+        std::vector<uint32_t> ids;      // Of the records appended.
+    };
+
+    int                   _fd;
+    std::vector<Segment>  _segments;
+    std::vector<uint32_t> _free;        // Recycled segments.
+    uint32_t              _current;     // Segment being appended to.
+    size_t                _liveBytes;
+
+public:
+    // Create the file in directory 'dir'.
+    explicit SpillFile(const std::string & dir) throw (Error);
+    ~SpillFile();
+
+    // Append a record, identified to the caller by 'id'. Returns false if
+    // the record is larger than a segment.
+    bool append(const std::vector<uint8_t> & data, uint32_t id,
+                uint32_t & segment, uint32_t & offset) throw (Error);
+    const uint8_t * read(uint32_t segment, uint32_t offset) const;
+    void release(uint32_t segment, uint32_t length);
+
+    // Get the segments, other than the current one, that are less than half
+    // live, and the ids of the records that were appended to a segment.
+    void getSparse(std::vector<uint32_t> & segments) const;
+    const std::vector<uint32_t> & getIds(uint32_t segment) const;
+
+    void getStats(size_t & liveBytes, size_t & fileBytes) const;
+
+protected:
+    uint32_t allocate() throw (Error);
+    void recycle(uint32_t segment);
+};
+
+#endif // COMMON__SPILL_FILE__HXX
@@ -8,9 +8,20 @@
 
 #include <algorithm>
 #include <numeric>
+#include <ctime>
 
 namespace {
 
+// Milliseconds between collecting the matches of a running search.
+const int SEARCH_POLL_INTERVAL = 50;
+
+// Milliseconds between checking on running exports.
+const int EXPORT_POLL_INTERVAL = 250;
+
+// Bytes of a selection pasted at a time, about what a tty takes at once.
+// The pieces are fed whenever there is nothing else to do.
+const size_t PASTE_CHUNK = 4096;
+
 int32_t nthArg(const std::vector<int32_t> & args, size_t n, int32_t fallback = 0) {
     return n < args.size() ? args[n] : fallback;
 }
@@ -77,6 +88,7 @@ Terminal::Terminal(I_Observer         & observer,
                    I_Selector         & selector,
                    I_Deduper          & deduper,
                    I_Destroyer        & destroyer,
+                   Governor           & governor,
                    int16_t              rows,
                    int16_t              cols,
                    const std::string  & windowId,
@@ -84,16 +96,33 @@ Terminal::Terminal(I_Observer         & observer,
     _observer(observer),
     //
     _config(config),
+    _selector(selector),
     _deduper(deduper),
+    _destroyer(destroyer),
+    _governor(governor),
     //
     _priBuffer(_config, deduper, destroyer, rows, cols,
                _config.unlimitedScrollBack ?
                std::numeric_limits<int32_t>::max() :
                _config.scrollBackHistory,
                CharSubArray(&CS_US, &CS_SPECIAL, &CS_US, &CS_US)),
-    _altBuffer(_config, deduper, destroyer, rows, cols, 0,
-               CharSubArray(&CS_US, &CS_SPECIAL, &CS_US, &CS_US)),
+    _altBuffer(),
+    _altReleasePending(false),
     _buffer(&_priBuffer),
+    _searchPoller(*this),
+    _searchPollPending(false),
+    _exporters(),
+    _exportPoller(*this),
+    _exportPollPending(false),
+    _pastes(),
+    _pasteFeeder(*this),
+    _pasteFeedPending(false),
+    _idleTimer(*this),
+    _idlePending(false),
+    _lastActive(std::chrono::steady_clock::now()),
+    _hibernating(false),
+    _awakeBytes(0),
+    _hibernatedBytes(0),
     //
     _modes(),
     //
@@ -111,9 +140,40 @@ Terminal::Terminal(I_Observer         & observer,
     _modes.set(Mode::SHOW_CURSOR);
     _modes.set(Mode::AUTO_REPEAT);
     _modes.set(Mode::ALT_SENDS_ESC);
+
+    _governor.add(this);
+
+    wake();
 }
 
-Terminal::~Terminal() {}
+Terminal::~Terminal() {
+    _governor.remove(this);
+
+    if (_altReleasePending) {
+        _selector.removeTimeoutable(this);
+    }
+
+    if (_searchPollPending) {
+        _selector.removeTimeoutable(&_searchPoller);
+    }
+
+    if (_exportPollPending) {
+        _selector.removeTimeoutable(&_exportPoller);
+    }
+
+    if (_pasteFeedPending) {
+        _selector.removeTimeoutable(&_pasteFeeder);
+    }
+
+    if (_idlePending) {
+        _selector.removeTimeoutable(&_idleTimer);
+    }
+
+    // Let the exports finish in the background.
+    for (auto & exporter : _exporters) {
+        _destroyer.add(exporter.release());
+    }
+}
 
 void Terminal::resize(int16_t rows, int16_t cols) {
     // Special exception, resizes can occur during dispatch to support
@@ -121,20 +181,29 @@ void Terminal::resize(int16_t rows, int16_t cols) {
 
     ASSERT(rows > 0 && cols > 0, "Rows or cols not positive.");
 
+    wake();
+
     _priBuffer.resizeReflow(rows, cols);
-    _altBuffer.resizeClip(rows, cols);
+    if (_altBuffer) {
+        _altBuffer->resizeClip(rows, cols);
+    }
     _tty.resize(rows, cols);
 }
 
 void Terminal::redraw() {
+    wake();
+
     Region damage;
     bool   scrollbar;
     draw(Trigger::CLIENT, damage, scrollbar);
 }
 
 bool Terminal::keyPress(xkb_keysym_t keySym, ModifierSet modifiers) {
+    wake();
+
     if (!handleKeyBinding(keySym, modifiers) && xkb::isPotent(keySym)) {
-        if (_config.scrollOnTtyKeyPress && _buffer->scrollBottomHistory()) {
+        if (_config.scrollOnTtyKeyPress && !_buffer->isSearching() &&
+            _buffer->scrollBottomHistory()) {
             fixDamage(Trigger::OTHER);
         }
 
@@ -173,6 +242,8 @@ void Terminal::buttonPress(Button button, int count, ModifierSet modifiers,
                            bool UNUSED(within), Pos pos, Hand hand) {
     ASSERT(_press == Press::NONE, "Received button press but already got one.");
 
+    wake();
+
     Pos adjPos(pos.row, pos.col + (hand == Hand::RIGHT ? 1 : 0));
 
     if (_modes.get(Mode::MOUSE_PRESS_RELEASE)) {
@@ -213,6 +284,8 @@ select:
 }
 
 void Terminal::pointerMotion(ModifierSet modifiers, bool within, Pos pos, Hand hand) {
+    wake();
+
     if ((_press == Press::REPORT && _modes.get(Mode::MOUSE_DRAG)) ||
         (_press == Press::NONE   && _modes.get(Mode::MOUSE_MOTION)))
     {
@@ -260,9 +333,11 @@ void Terminal::pointerMotion(ModifierSet modifiers, bool within, Pos pos, Hand h
 void Terminal::buttonRelease(bool UNUSED(broken), ModifierSet modifiers) {
     ASSERT(_press != Press::NONE, "Received button release but have no press.");
 
+    wake();
+
     if (_press == Press::SELECT) {
-        std::string text;
-        if (_buffer->getSelectedText(text)) {
+        auto text = _buffer->copySelection();
+        if (text) {
             _observer.terminalCopy(text, Selection::PRIMARY);
         }
 
@@ -311,6 +386,8 @@ report:
 }
 
 void Terminal::scrollWheel(ScrollDir dir, ModifierSet modifiers, bool UNUSED(within), Pos pos) {
+    wake();
+
     if (_modes.get(Mode::MOUSE_PRESS_RELEASE)) {
         sendMouseButton(dir == ScrollDir::UP ? 3 : 4, modifiers, pos);
     }
@@ -336,18 +413,19 @@ void Terminal::scrollWheel(ScrollDir dir, ModifierSet modifiers, bool UNUSED(wit
 }
 
 void Terminal::paste(const uint8_t * data, size_t size) {
-    if (_config.scrollOnPaste && _buffer->scrollBottomHistory()) {
-        fixDamage(Trigger::OTHER);
-    }
-
-    if (_modes.get(Mode::BRACKETED_PASTE)) {
-        write(reinterpret_cast<const uint8_t *>("\x1B[200~"), 6);
-    }
+    _pastes.emplace_back(std::string(reinterpret_cast<const char *>(data), size));
+    schedulePaste();
+}
 
-    write(data, size);
+void Terminal::paste(const std::shared_ptr<SelectedText> & text) {
+    _pastes.emplace_back(text);
+    schedulePaste();
+}
 
-    if (_modes.get(Mode::BRACKETED_PASTE)) {
-        write(reinterpret_cast<const uint8_t *>("\x1B[201~"), 6);
+void Terminal::schedulePaste() {
+    if (!_pasteFeedPending) {
+        _selector.addTimeoutable(&_pasteFeeder, 0);
+        _pasteFeedPending = true;
     }
 }
 
@@ -360,12 +438,14 @@ void Terminal::killReap() {
 }
 
 void Terminal::clearSelection() {
+    wake();
     _buffer->clearSelection();
     fixDamage(Trigger::OTHER);
 }
 
 void Terminal::focusChange(bool focused) {
     if (_focused != focused) {
+        wake();
         _focused = focused;
 
         if (_modes.get(Mode::FOCUS)) {
@@ -387,6 +467,49 @@ bool Terminal::hasSubprocess() const {
     return _tty.hasSubprocess();
 }
 
+void Terminal::getHistory(std::vector<I_Deduper::Tag>    & tags,
+                          std::vector<std::vector<Cell>> & paras) const {
+    // Only the primary buffer has history.
+    _priBuffer.getHistory(tags, paras);
+}
+
+uint32_t Terminal::getHistory(uint32_t                         since,
+                              uint32_t                       & lost,
+                              std::vector<I_Deduper::Tag>    & tags,
+                              std::vector<std::vector<Cell>> & paras) const {
+    return _priBuffer.getHistory(since, lost, tags, paras);
+}
+
+void Terminal::restoreHistory(const std::vector<I_Deduper::Tag> & tags) {
+    wake();
+    _priBuffer.restoreHistory(tags);
+    fixDamage(Trigger::OTHER);
+}
+
+void Terminal::exportHistory(const std::string & path, bool styles) {
+    std::vector<I_Deduper::Tag>    tags;
+    std::vector<std::vector<Cell>> paras;
+    getHistory(tags, paras);
+
+    try {
+        _exporters.emplace_back(new Exporter(_deduper, std::move(tags), std::move(paras),
+                                             path, styles));
+    }
+    catch (const Exporter::Error & error) {
+        ERROR(error.message);
+        return;
+    }
+
+    if (!_exportPollPending) {
+        _selector.addTimeoutable(&_exportPoller, EXPORT_POLL_INTERVAL);
+        _exportPollPending = true;
+    }
+}
+
+size_t Terminal::getResidentBytes() const {
+    return _priBuffer.getResidentBytes() + (_altBuffer ? _altBuffer->getResidentBytes() : 0);
+}
+
 bool Terminal::handleKeyBinding(xkb_keysym_t keySym, ModifierSet modifiers) {
     // Unset the modifiers that don't count when matching.
     modifiers.unset(Modifier::NUM_LOCK);
@@ -431,8 +554,8 @@ bool Terminal::handleKeyBinding(xkb_keysym_t keySym, ModifierSet modifiers) {
                 _observer.terminalResizeGlobalFont(-1);
                 return true;
             case Action::COPY_TO_CLIPBOARD: {
-                std::string text;
-                if (_buffer->getSelectedText(text)) {
+                auto text = _buffer->copySelection();
+                if (text) {
                     _observer.terminalCopy(text, Selection::CLIPBOARD);
                 }
                 return true;
@@ -470,21 +593,50 @@ bool Terminal::handleKeyBinding(xkb_keysym_t keySym, ModifierSet modifiers) {
                     fixDamage(Trigger::OTHER);
                 }
                 return true;
+            case Action::SCROLL_PREV_PROMPT:
+                if (_buffer->scrollPrevPrompt()) {
+                    fixDamage(Trigger::OTHER);
+                }
+                return true;
+            case Action::SCROLL_NEXT_PROMPT:
+                if (_buffer->scrollNextPrompt()) {
+                    fixDamage(Trigger::OTHER);
+                }
+                return true;
             case Action::CLEAR_HISTORY:
                 _priBuffer.clearHistory();
                 fixDamage(Trigger::OTHER);
                 return true;
+            case Action::SAVE_HISTORY: {
+                char stamp[32];
+                auto now = ::time(nullptr);
+                ::strftime(stamp, sizeof stamp, "%Y%m%d-%H%M%S", ::localtime(&now));
+                exportHistory(_config.historyExportDir + "/terminol-history-" + stamp + ".txt",
+                              _config.historyExportStyles);
+                return true;
+            }
             case Action::SEARCH:
                 if (_buffer->isSearching()) {
-                    _tty.resume();
-                    _buffer->endSearch();
+                    endSearch();
                 }
                 else {
                     _tty.suspend();
-                    _buffer->beginSearch("da");
+                    _buffer->beginSearch("");
                 }
                 fixDamage(Trigger::CLIENT); // kludgy
                 return true;
+            case Action::SEARCH_NEXT:
+                if (_buffer->isSearching()) {
+                    _buffer->nextSearch();
+                    fixDamage(Trigger::OTHER);
+                }
+                return true;
+            case Action::SEARCH_PREV:
+                if (_buffer->isSearching()) {
+                    _buffer->prevSearch();
+                    fixDamage(Trigger::OTHER);
+                }
+                return true;
             case Action::DEBUG_GLOBAL_TAGS:
                 _deduper.dump(std::cerr);
                 return true;
@@ -510,9 +662,32 @@ bool Terminal::handleKeyBinding(xkb_keysym_t keySym, ModifierSet modifiers) {
                 size_t uniqueBytes, totalBytes;
                 _deduper.getByteStats(uniqueBytes, totalBytes);
 
+                auto residentBytes = _deduper.getResidentBytes();
+
+                size_t rawBytes, compressedBytes;
+                _deduper.getCompressionStats(rawBytes, compressedBytes);
+                double ratio =
+                    compressedBytes == 0 ? 0.0 :
+                    static_cast<double>(rawBytes) / compressedBytes;
+
+                uint32_t hotLookups, warmLookups;
+                double   hotMicros, warmMicros;
+                _deduper.getLookupStats(hotLookups, hotMicros, warmLookups, warmMicros);
+
+                size_t spilledBytes, fileBytes;
+                _deduper.getSpillStats(spilledBytes, fileBytes);
+
                 std::ostringstream ost;
                 ost << "line-data="   << humanSize(uniqueBytes) << " "
-                    << "(non-dedupe=" << humanSize(totalBytes) << ")";
+                    << "(non-dedupe=" << humanSize(totalBytes) << ")"
+                    << " resident=" << humanSize(residentBytes)
+                    << " compressed=" << humanSize(rawBytes)
+                    << "->" << humanSize(compressedBytes)
+                    << " (ratio=" << ratio << ")"
+                    << " lookup-us=" << hotMicros << "/" << warmMicros
+                    << " (hot/warm of " << hotLookups << "/" << warmLookups << ")"
+                    << " spilled=" << humanSize(spilledBytes)
+                    << " (file=" << humanSize(fileBytes) << ")";
                 _observer.terminalSetWindowTitle(ost.str(), true);
                 return true;
             }
@@ -525,11 +700,30 @@ bool Terminal::handleKeyBinding(xkb_keysym_t keySym, ModifierSet modifiers) {
                     uniqueLines == 0 ? 0.0 :
                     static_cast<double>(globalLines) / uniqueLines;
 
+                uint32_t dispatchedRows;
+                uint32_t skippedRows;
+                _buffer->getDispatchStats(dispatchedRows, skippedRows);
+
+                uint32_t cacheHits;
+                uint32_t cacheMisses;
+                _buffer->getParaCacheStats(cacheHits, cacheMisses);
+
                 std::ostringstream ost;
                 ost << "local=" << localLines
                     << " global=" << globalLines
                     << " unique=" << uniqueLines
-                    << " (dedupe-factor=" << dedupe << ")";
+                    << " (dedupe-factor=" << dedupe << ")"
+                    << " rows-skipped=" << skippedRows
+                    << "/" << dispatchedRows + skippedRows
+                    << " para-cache-hits=" << cacheHits
+                    << "/" << cacheHits + cacheMisses
+                    << " resident=" << humanSize(getResidentBytes());
+
+                if (_hibernatedBytes != 0) {
+                    ost << " (hibernated=" << humanSize(_awakeBytes)
+                        << "->" << humanSize(_hibernatedBytes) << ")";
+                }
+
                 _observer.terminalSetWindowTitle(ost.str(), true);
                 return true;
             }
@@ -560,6 +754,7 @@ void Terminal::draw(Trigger trigger, Region & damage, bool & scrollbar) {
 
     if (trigger == Trigger::FOCUS) {
         if (_modes.get(Mode::SHOW_CURSOR) && !_buffer->isSearching()) {
+            _buffer->resetSnapshot();       // The cursor's appearance depends on focus.
             _buffer->damageCell();
             _buffer->accumulateDamage(damage);
             _buffer->dispatch(_modes.get(Mode::REVERSE), *this);
@@ -569,6 +764,7 @@ void Terminal::draw(Trigger trigger, Region & damage, bool & scrollbar) {
     }
     else {
         if (trigger == Trigger::CLIENT) {
+            _buffer->resetSnapshot();
             _buffer->damageViewport(true);
         }
 
@@ -592,12 +788,229 @@ void Terminal::draw(Trigger trigger, Region & damage, bool & scrollbar) {
 
 void Terminal::write(const uint8_t * data, size_t size) {
     if (_buffer->isSearching()) {
+        editSearch(data, size);
     }
     else {
         _tty.write(data, size);
     }
 }
 
+void Terminal::beginPaste() {
+    wake();
+
+    if (_config.scrollOnPaste && !_buffer->isSearching() &&
+        _buffer->scrollBottomHistory()) {
+        fixDamage(Trigger::OTHER);
+    }
+
+    if (_modes.get(Mode::BRACKETED_PASTE)) {
+        write(reinterpret_cast<const uint8_t *>("\x1B[200~"), 6);
+    }
+}
+
+void Terminal::endPaste() {
+    if (_modes.get(Mode::BRACKETED_PASTE)) {
+        write(reinterpret_cast<const uint8_t *>("\x1B[201~"), 6);
+    }
+}
+
+void Terminal::feedPaste() {
+    ASSERT(_pasteFeedPending, "");
+    _pasteFeedPending = false;
+
+    wake();
+
+    auto & paste = _pastes.front();
+
+    if (!paste.started) {
+        beginPaste();
+        paste.started = true;
+    }
+
+    std::string chunk;
+    bool        more;
+
+    if (paste.text) {
+        more = paste.text->read(paste.cursor, chunk, PASTE_CHUNK);
+    }
+    else {
+        chunk = paste.bytes.substr(paste.offset, PASTE_CHUNK);
+        paste.offset += chunk.size();
+        more = !chunk.empty();
+    }
+
+    if (more) {
+        if (!chunk.empty()) {
+            write(reinterpret_cast<const uint8_t *>(chunk.data()), chunk.size());
+        }
+    }
+    else {
+        endPaste();
+        _pastes.pop_front();
+    }
+
+    if (!_pastes.empty()) {
+        schedulePaste();
+    }
+}
+
+void Terminal::editSearch(const uint8_t * data, size_t size) {
+    auto pattern = _buffer->getSearchPattern();
+
+    if (size == 1 && data[0] == ESC) {
+        endSearch();
+        fixDamage(Trigger::CLIENT);
+        return;
+    }
+
+    for (size_t i = 0; i != size; ++i) {
+        auto c = data[i];
+
+        if (c == BS || c == DEL) {
+            // Erase the last UTF-8 sequence.
+            while (!pattern.empty() && (pattern.back() & 0xC0) == 0x80) {
+                pattern.pop_back();
+            }
+
+            if (!pattern.empty()) {
+                pattern.pop_back();
+            }
+        }
+        else if (c == CR || c == LF) {
+            _buffer->nextSearch();
+        }
+        else if (c == ESC) {
+            // Ignore the rest of an escape sequence.
+            break;
+        }
+        else if (c >= SPACE) {
+            pattern.push_back(c);
+        }
+    }
+
+    _buffer->setSearchPattern(pattern);
+
+    if (!_searchPollPending && _buffer->isSearchRunning()) {
+        _selector.addTimeoutable(&_searchPoller, SEARCH_POLL_INTERVAL);
+        _searchPollPending = true;
+    }
+
+    fixDamage(Trigger::OTHER);
+}
+
+void Terminal::endSearch() {
+    if (_searchPollPending) {
+        _selector.removeTimeoutable(&_searchPoller);
+        _searchPollPending = false;
+    }
+
+    _buffer->endSearch();
+    _tty.resume();
+}
+
+void Terminal::pollSearch() {
+    ASSERT(_searchPollPending, "");
+    _searchPollPending = false;
+
+    if (_buffer->updateSearch()) {
+        fixDamage(Trigger::OTHER);
+    }
+
+    if (_buffer->isSearchRunning()) {
+        _selector.addTimeoutable(&_searchPoller, SEARCH_POLL_INTERVAL);
+        _searchPollPending = true;
+    }
+}
+
+void Terminal::pollExports() {
+    ASSERT(_exportPollPending, "");
+    _exportPollPending = false;
+
+    for (auto iter = _exporters.begin(); iter != _exporters.end();) {
+        std::string error;
+
+        if ((*iter)->isFinished(error)) {
+            if (error.empty()) {
+                PRINT("Exported history to " << (*iter)->getPath());
+            }
+            else {
+                ERROR(error);
+            }
+
+            iter = _exporters.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+
+    if (!_exporters.empty()) {
+        _selector.addTimeoutable(&_exportPoller, EXPORT_POLL_INTERVAL);
+        _exportPollPending = true;
+    }
+}
+
+void Terminal::wake() {
+    _lastActive = std::chrono::steady_clock::now();
+
+    if (_hibernating) {
+        _priBuffer.thaw();
+        if (_altBuffer) {
+            _altBuffer->thaw();
+        }
+        _hibernating = false;
+    }
+
+    if (!_idlePending && _config.hibernateDelay != 0) {
+        _selector.addTimeoutable(&_idleTimer, _config.hibernateDelay);
+        _idlePending = true;
+    }
+}
+
+void Terminal::checkIdle() {
+    ASSERT(_idlePending, "");
+    _idlePending = false;
+
+    // The timer isn't rescheduled by each bit of activity, so it may be
+    // early.
+    auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - _lastActive).count();
+    auto delay = static_cast<int64_t>(_config.hibernateDelay);
+
+    if (idle < delay) {
+        _selector.addTimeoutable(&_idleTimer, static_cast<int>(delay - idle));
+        _idlePending = true;
+    }
+    else if (_buffer->isSearching() || _press != Press::NONE) {
+        // Wait for these to end.
+        _selector.addTimeoutable(&_idleTimer, delay);
+        _idlePending = true;
+    }
+    else {
+        hibernate();
+    }
+}
+
+void Terminal::hibernate() {
+    ASSERT(!_hibernating, "");
+    _awakeBytes = getResidentBytes();
+
+    // The alternate screen would be released soon anyway.
+    if (_altReleasePending) {
+        _selector.removeTimeoutable(this);
+        _altReleasePending = false;
+        _altBuffer.reset();
+    }
+
+    _priBuffer.hibernate();
+    if (_altBuffer) {
+        _altBuffer->hibernate();
+    }
+
+    _hibernating     = true;
+    _hibernatedBytes = getResidentBytes();
+}
+
 void Terminal::echo(const uint8_t * data, size_t size) {
     while (size != 0) {
         auto c = *data;
@@ -670,6 +1083,32 @@ void Terminal::resetAll() {
     _observer.terminalResetTitleAndIcon();
 }
 
+Buffer & Terminal::getAltBuffer() {
+    if (_altReleasePending) {
+        _selector.removeTimeoutable(this);
+        _altReleasePending = false;
+    }
+
+    if (!_altBuffer) {
+        _altBuffer.reset(new Buffer(_config, _deduper, _destroyer, getRows(), getCols(), 0,
+                                    CharSubArray(&CS_US, &CS_SPECIAL, &CS_US, &CS_US)));
+    }
+
+    return *_altBuffer;
+}
+
+void Terminal::switchBuffer(Buffer & newBuffer) {
+    _buffer = &newBuffer;
+
+    if (_buffer == &_priBuffer) {
+        // Many programs never return to the alternate screen, so don't
+        // hold on to it.
+        ASSERT(!_altReleasePending, "");
+        _selector.addTimeoutable(this, _config.altBufferReleaseDelay);
+        _altReleasePending = true;
+    }
+}
+
 void Terminal::processRead(const uint8_t * data, size_t size) {
     for (size_t i = 0; i != size; ++i) {
         switch (_utf8Machine.consume(data[i])) {
@@ -1001,10 +1440,10 @@ void Terminal::processModes(uint8_t priv, bool set, const std::vector<int32_t> &
                     //NYI("Ignored: "  << a << ", " << set);
                     break;
                 case 47: {
-                    Buffer * newBuffer = set ? &_altBuffer : &_priBuffer;
+                    Buffer * newBuffer = set ? &getAltBuffer() : &_priBuffer;
                     if (_buffer != newBuffer) {
                         newBuffer->migrateFrom(*_buffer, false);
-                        _buffer = newBuffer;
+                        switchBuffer(*newBuffer);
                     }
                 } break;
                 case 1000: // Mouse X11 (button press and release)
@@ -1080,10 +1519,10 @@ void Terminal::processModes(uint8_t priv, bool set, const std::vector<int32_t> &
                     _modes.setTo(Mode::ALT_SENDS_ESC, set);
                     break;
                 case 1047: {
-                    Buffer * newBuffer = set ? &_altBuffer : &_priBuffer;
+                    Buffer * newBuffer = set ? &getAltBuffer() : &_priBuffer;
                     if (_buffer != newBuffer) {
                         newBuffer->migrateFrom(*_buffer, set);
-                        _buffer = newBuffer;
+                        switchBuffer(*newBuffer);
                     }
                 } break;
                 case 1048:
@@ -1095,11 +1534,11 @@ void Terminal::processModes(uint8_t priv, bool set, const std::vector<int32_t> &
                     }
                     break;
                 case 1049: { // rmcup/smcup, alternative screen
-                    Buffer * newBuffer = set ? &_altBuffer : &_priBuffer;
+                    Buffer * newBuffer = set ? &getAltBuffer() : &_priBuffer;
                     if (_buffer != newBuffer) {
                         if (set) { _buffer->saveCursor(); }
                         newBuffer->migrateFrom(*_buffer, set);
-                        _buffer = newBuffer;
+                        switchBuffer(*newBuffer);
                         if (!set) { _buffer->restoreCursor(); }
                     }
                 } break;
@@ -1650,6 +2089,13 @@ void Terminal::machineOscEsc(const OscEsc & esc) {
                 case 112:
                     // tmux gives us this...
                     break;
+                case 133: // Shell integration (FinalTerm)
+                    // A: prompt start, B: command start, C: command executed,
+                    // D: command finished. Only the prompts are kept.
+                    if (esc.args.size() > 1 && esc.args[1] == "A") {
+                        _buffer->markPrompt();
+                    }
+                    break;
                 case 666: // terminol extension (fix the damage)
                     fixDamage(Trigger::TTY);
                     break;
@@ -1674,10 +2120,12 @@ void Terminal::machineOscEsc(const OscEsc & esc) {
 // Tty::I_Observer implementation:
 
 void Terminal::ttyData(const uint8_t * data, size_t size) {
+    wake();
     processRead(data, size);
 }
 
 void Terminal::ttySync() {
+    wake();
     fixDamage(Trigger::TTY);
 }
 
@@ -1685,6 +2133,28 @@ void Terminal::ttyReaped(int status) {
     _observer.terminalReaped(status);
 }
 
+// I_Selector::I_TimeoutHandler implementation:
+
+void Terminal::handleTimeout() {
+    ASSERT(_altReleasePending, "");
+    ASSERT(_buffer == &_priBuffer, "");
+    _altReleasePending = false;
+    _altBuffer.reset();
+}
+
+// Governor::I_Client implementation:
+
+size_t Terminal::governorHistorySize() const {
+    // Only the primary buffer has history.
+    return _priBuffer.getHistoryCells();
+}
+
+void Terminal::governorTrimHistory(size_t cells) {
+    wake();
+    _priBuffer.trimHistory(cells);
+    fixDamage(Trigger::OTHER);
+}
+
 // Buffer::I_Renderer implementation
 
 void Terminal::bufferDrawBg(Pos     pos,
@@ -1712,6 +2182,12 @@ void Terminal::bufferDrawCursor(Pos             pos,
     _observer.terminalDrawCursor(pos, fg, bg, attrs, str, size, wrapNext, _focused);
 }
 
+bool Terminal::bufferMoveRows(int16_t begin,
+                              int16_t end,
+                              int16_t rows) {
+    return _observer.terminalMoveRows(begin, end, rows);
+}
+
 std::ostream & operator << (std::ostream & ost, Terminal::Button button) {
     switch (button) {
         case Terminal::Button::LEFT:
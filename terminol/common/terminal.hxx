@@ -10,16 +10,24 @@
 #include "terminol/common/bit_sets.hxx"
 #include "terminol/common/buffer.hxx"
 #include "terminol/common/deduper_interface.hxx"
+#include "terminol/common/governor.hxx"
+#include "terminol/common/exporter.hxx"
 #include "terminol/support/async_destroyer.hxx"
 #include "terminol/support/selector.hxx"
 #include "terminol/support/pattern.hxx"
 
 #include <xkbcommon/xkbcommon.h>
 
+#include <memory>
+#include <deque>
+#include <chrono>
+
 class Terminal :
     protected VtStateMachine::I_Observer,
     protected Tty::I_Observer,
     protected Buffer::I_Renderer,
+    protected I_Selector::I_TimeoutHandler,
+    protected Governor::I_Client,
     protected Uncopyable
 {
     static const CharSub CS_US;
@@ -32,7 +40,7 @@ public:
     class I_Observer {
     public:
         virtual const std::string & terminalGetDisplayName() const = 0;
-        virtual void terminalCopy(const std::string & text, Selection selection) = 0;
+        virtual void terminalCopy(std::shared_ptr<SelectedText> text, Selection selection) = 0;
         virtual void terminalPaste(Selection selection) = 0;
         virtual void terminalResizeLocalFont(int delta) = 0;
         virtual void terminalResizeGlobalFont(int delta) = 0;
@@ -59,6 +67,9 @@ public:
                                         size_t          size,
                                         bool            wrapNext,
                                         bool            focused) = 0;
+        virtual bool terminalMoveRows(int16_t begin,
+                                      int16_t end,
+                                      int16_t rows) = 0;
         virtual void terminalDrawScrollbar(size_t  totalRows,
                                            size_t  historyOffset,
                                            int16_t visibleRows) = 0;
@@ -78,14 +89,93 @@ public:
     enum class ScrollDir { UP, DOWN };
 
 private:
+    // Collects the matches of a running search, see pollSearch().
+    class SearchPoller : public I_Selector::I_TimeoutHandler {
+        Terminal & _terminal;
+
+    public:
+        explicit SearchPoller(Terminal & terminal) : _terminal(terminal) {}
+        virtual ~SearchPoller() {}
+
+        void handleTimeout() override { _terminal.pollSearch(); }
+    };
+
+    // Reports the exports that have finished, see pollExports().
+    class ExportPoller : public I_Selector::I_TimeoutHandler {
+        Terminal & _terminal;
+
+    public:
+        explicit ExportPoller(Terminal & terminal) : _terminal(terminal) {}
+        virtual ~ExportPoller() {}
+
+        void handleTimeout() override { _terminal.pollExports(); }
+    };
+
+    // Feeds the pasted selections to the tty, see feedPaste().
+    class PasteFeeder : public I_Selector::I_TimeoutHandler {
+        Terminal & _terminal;
+
+    public:
+        explicit PasteFeeder(Terminal & terminal) : _terminal(terminal) {}
+        virtual ~PasteFeeder() {}
+
+        void handleTimeout() override { _terminal.feedPaste(); }
+    };
+
+    // A selection, or bytes from another client, being pasted a piece at
+    // a time.
+    struct Paste {
+        std::shared_ptr<SelectedText> text;     // Null for bytes.
+        SelectedText::Cursor          cursor;
+        std::string                   bytes;
+        size_t                        offset;   // Within bytes.
+        bool                          started;  // Has beginPaste() been called?
+
+        explicit Paste(const std::shared_ptr<SelectedText> & text_) :
+            text(text_), cursor(text_->begin()), bytes(), offset(0), started(false) {}
+
+        explicit Paste(std::string && bytes_) :
+            text(), cursor(0, 0), bytes(std::move(bytes_)), offset(0), started(false) {}
+    };
+
+    // Hibernates the terminal once it has been idle for long enough, see
+    // checkIdle().
+    class IdleTimer : public I_Selector::I_TimeoutHandler {
+        Terminal & _terminal;
+
+    public:
+        explicit IdleTimer(Terminal & terminal) : _terminal(terminal) {}
+        virtual ~IdleTimer() {}
+
+        void handleTimeout() override { _terminal.checkIdle(); }
+    };
+
     I_Observer          & _observer;
 
     const Config        & _config;
-    const I_Deduper     & _deduper;
-
-    Buffer                _priBuffer;
-    Buffer                _altBuffer;
-    Buffer              * _buffer;
+    I_Selector          & _selector;
+    I_Deduper           & _deduper;
+    I_Destroyer         & _destroyer;
+    Governor            & _governor;
+
+    Buffer                  _priBuffer;
+    std::unique_ptr<Buffer> _altBuffer;         // Created on demand, released when idle.
+    bool                    _altReleasePending; // Is the release of _altBuffer scheduled?
+    Buffer                * _buffer;
+    SearchPoller            _searchPoller;
+    bool                    _searchPollPending; // Is _searchPoller scheduled?
+    std::vector<std::unique_ptr<Exporter>> _exporters;
+    ExportPoller            _exportPoller;
+    bool                    _exportPollPending; // Is _exportPoller scheduled?
+    std::deque<Paste>       _pastes;            // The first is being fed.
+    PasteFeeder             _pasteFeeder;
+    bool                    _pasteFeedPending;  // Is _pasteFeeder scheduled?
+    IdleTimer               _idleTimer;
+    bool                    _idlePending;       // Is _idleTimer scheduled?
+    std::chrono::steady_clock::time_point _lastActive;
+    bool                    _hibernating;
+    size_t                  _awakeBytes;        // Resident before the last hibernation.
+    size_t                  _hibernatedBytes;   // Resident after it.
 
     ModeSet               _modes;
 
@@ -110,6 +200,7 @@ public:
              I_Selector         & selector,
              I_Deduper          & deduper,
              I_Destroyer        & destroyer,
+             Governor           & governor,
              int16_t              rows,
              int16_t              cols,
              const std::string  & windowId,
@@ -134,7 +225,9 @@ public:
     void     buttonRelease(bool broken, ModifierSet modifiers);
     void     scrollWheel(ScrollDir dir, ModifierSet modifiers, bool within, Pos pos);
 
+    // Paste in the background, after any others.
     void     paste(const uint8_t * data, size_t size);
+    void     paste(const std::shared_ptr<SelectedText> & text);
 
     void     tryReap();
     void     killReap();
@@ -144,6 +237,22 @@ public:
 
     bool     hasSubprocess() const;
 
+    // History, for snapshots (see Buffer):
+
+    void     getHistory(std::vector<I_Deduper::Tag>    & tags,
+                        std::vector<std::vector<Cell>> & paras) const;
+    uint32_t getHistory(uint32_t                         since,
+                        uint32_t                       & lost,
+                        std::vector<I_Deduper::Tag>    & tags,
+                        std::vector<std::vector<Cell>> & paras) const;
+    void     restoreHistory(const std::vector<I_Deduper::Tag> & tags);
+
+    // Write the history to a file in the background (see Exporter).
+    void     exportHistory(const std::string & path, bool styles);
+
+    // Approximately how many bytes do the buffers hold (see Buffer)?
+    size_t   getResidentBytes() const;
+
 protected:
     enum class Trigger { TTY, FOCUS, CLIENT, OTHER };
 
@@ -154,12 +263,28 @@ protected:
     void     draw(Trigger trigger, Region & damage, bool & scrollbar);
 
     void     write(const uint8_t * data, size_t size);
+    void     beginPaste();
+    void     endPaste();
+    void     schedulePaste();
+    void     feedPaste();
+    void     editSearch(const uint8_t * data, size_t size);
+    void     endSearch();
+    void     pollSearch();
+    void     pollExports();
+    // Note activity, waking the buffers if hibernating. Must precede any
+    // use of the buffers.
+    void     wake();
+    void     checkIdle();
+    void     hibernate();
     void     echo(const uint8_t * data, size_t size);
 
     void     sendMouseButton(int num, ModifierSet modifiers, Pos pos);
 
     void     resetAll();
 
+    Buffer & getAltBuffer();
+    void     switchBuffer(Buffer & newBuffer);
+
     void     processRead(const uint8_t * data, size_t size);
     void     processChar(utf8::Seq seq, utf8::Length length);
 
@@ -183,6 +308,15 @@ protected:
     void     ttySync() override;
     void     ttyReaped(int status) override;
 
+    // I_Selector::I_TimeoutHandler implementation:
+
+    void     handleTimeout() override;
+
+    // Governor::I_Client implementation:
+
+    size_t   governorHistorySize() const override;
+    void     governorTrimHistory(size_t cells) override;
+
     // Buffer::I_Renderer implementation:
 
     void     bufferDrawBg(Pos     pos,
@@ -201,6 +335,9 @@ protected:
                               const uint8_t * str,
                               size_t          size,
                               bool            wrapNext) override;
+    bool     bufferMoveRows(int16_t begin,
+                            int16_t end,
+                            int16_t rows) override;
 };
 
 std::ostream & operator << (std::ostream & ost, Terminal::Button button);
@@ -0,0 +1,56 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/trigram_index.hxx"
+#include "terminol/support/debug.hxx"
+
+#include <cstring>
+
+namespace {
+
+void add(TrigramIndex & index, I_Deduper::Tag tag, const char * text) {
+    std::vector<TrigramIndex::Gram> grams;
+    TrigramIndex::extract(reinterpret_cast<const uint8_t *>(text), strlen(text), grams);
+    index.add(tag, grams);
+}
+
+std::vector<I_Deduper::Tag> find(const TrigramIndex & index,
+                                 const std::vector<std::string> & literals) {
+    std::vector<I_Deduper::Tag> tags;
+    index.find(literals, tags);
+    return tags;
+}
+
+} // namespace {anonymous}
+
+int main() {
+    typedef std::vector<I_Deduper::Tag> Tags;
+
+    std::vector<TrigramIndex::Gram> grams;
+    TrigramIndex::extract(reinterpret_cast<const uint8_t *>("ababab"), 6, grams);
+    ENFORCE(grams.size() == 2, grams.size());       // "aba" and "bab".
+    TrigramIndex::extract(reinterpret_cast<const uint8_t *>("ab"), 2, grams);
+    ENFORCE(grams.empty(), grams.size());
+
+    TrigramIndex index;
+    add(index, 7, "make install");
+    add(index, 3, "make clean");
+    add(index, 5, "git status");
+
+    ENFORCE(find(index, {"make"}) == Tags({3, 7}), "");
+    ENFORCE(find(index, {"make", "inst"}) == Tags({7}), "");
+    ENFORCE(find(index, {"ma", "status"}) == Tags({5}), "");
+    ENFORCE(find(index, {"cmake"}).empty(), "");
+
+    // Removal is lazy, until pruned.
+    auto count = index.getCount();
+    index.getGrams(grams);
+    for (auto gram : grams) {
+        index.prune(gram, [](I_Deduper::Tag tag) { return tag != 7; });
+    }
+    ENFORCE(index.getCount() < count, "");
+    ENFORCE(find(index, {"make"}) == Tags({3}), "");
+    ENFORCE(find(index, {"install"}).empty(), "");
+
+    return 0;
+}
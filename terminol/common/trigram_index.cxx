@@ -0,0 +1,107 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#include "terminol/common/trigram_index.hxx"
+
+void TrigramIndex::extract(const uint8_t * text, size_t size, std::vector<Gram> & grams) {
+    grams.clear();
+
+    for (size_t i = 2; i < size; ++i) {
+        grams.push_back(text[i - 2] << 16 | text[i - 1] << 8 | text[i]);
+    }
+
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+}
+
+void TrigramIndex::extract(const std::vector<Cell> & cells, std::vector<Gram> & grams) {
+    std::vector<uint8_t> text;
+
+    for (auto & cell : cells) {
+        auto & seq = cell.seq;
+        text.insert(text.end(), &seq.bytes[0], &seq.bytes[utf8::leadLength(seq.lead())]);
+    }
+
+    extract(text.data(), text.size(), grams);
+}
+
+TrigramIndex::TrigramIndex() :
+    _postings(),
+    _count(0) {}
+
+void TrigramIndex::add(I_Deduper::Tag tag, const std::vector<Gram> & grams) {
+    for (auto gram : grams) {
+        _postings[gram].push_back(tag);
+    }
+
+    _count += grams.size();
+}
+
+void TrigramIndex::find(const std::vector<std::string> & literals,
+                        std::vector<I_Deduper::Tag>    & tags) const {
+    tags.clear();
+
+    std::vector<Gram> grams;
+
+    for (auto & literal : literals) {
+        std::vector<Gram> more;
+        extract(reinterpret_cast<const uint8_t *>(literal.data()), literal.size(), more);
+        grams.insert(grams.end(), more.begin(), more.end());
+    }
+
+    ASSERT(!grams.empty(), "No literal is long enough.");
+
+    std::vector<const std::vector<I_Deduper::Tag> *> lists;
+
+    for (auto gram : grams) {
+        auto iter = _postings.find(gram);
+
+        if (iter == _postings.end()) {
+            // No entry contains this trigram.
+            return;
+        }
+
+        lists.push_back(&iter->second);
+    }
+
+    // Intersect the postings, shortest first, so that the candidates only
+    // shrink from the smallest set.
+    std::sort(lists.begin(), lists.end(),
+              [](const std::vector<I_Deduper::Tag> * lhs, const std::vector<I_Deduper::Tag> * rhs) {
+                  return lhs->size() < rhs->size();
+              });
+
+    tags = *lists.front();
+    std::sort(tags.begin(), tags.end());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+
+    for (auto iter = lists.begin() + 1; iter != lists.end() && !tags.empty(); ++iter) {
+        std::vector<bool> found(tags.size(), false);
+
+        for (auto tag : **iter) {
+            auto pos = std::lower_bound(tags.begin(), tags.end(), tag);
+
+            if (pos != tags.end() && *pos == tag) {
+                found[pos - tags.begin()] = true;
+            }
+        }
+
+        size_t count = 0;
+
+        for (size_t i = 0; i != tags.size(); ++i) {
+            if (found[i]) {
+                tags[count++] = tags[i];
+            }
+        }
+
+        tags.resize(count);
+    }
+}
+
+void TrigramIndex::getGrams(std::vector<Gram> & grams) const {
+    grams.clear();
+
+    for (auto & pair : _postings) {
+        grams.push_back(pair.first);
+    }
+}
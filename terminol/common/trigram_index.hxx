@@ -0,0 +1,75 @@
+// vi:noai:sw=4
+// Copyright © 2015 David Bryant
+
+#ifndef COMMON__TRIGRAM_INDEX__HXX
+#define COMMON__TRIGRAM_INDEX__HXX
+
+#include "terminol/common/deduper_interface.hxx"
+#include "terminol/support/pattern.hxx"
+
+#include <algorithm>
+#include <unordered_map>
+#include <string>
+#include <vector>
+
+// TrigramIndex maps each trigram (three consecutive bytes of UTF-8 text) to
+// the tags of the entries containing it, so that a search for some literal
+// text need only look at the entries containing all of its trigrams.
+// Removing an entry leaves its postings behind, to be pruned in bulk, so the
+// tags found may include entries that no longer exist.
+class TrigramIndex : private Uncopyable {
+public:
+    typedef uint32_t Gram;
+
+    // Get the distinct trigrams of some text, sorted.
+    static void extract(const uint8_t * text, size_t size, std::vector<Gram> & grams);
+    static void extract(const std::vector<Cell> & cells, std::vector<Gram> & grams);
+
+private:
+    typedef std::unordered_map<Gram, std::vector<I_Deduper::Tag>> Postings;
+
+    Postings _postings;
+    size_t   _count;        // Number of postings.
+
+public:
+    TrigramIndex();
+
+    void add(I_Deduper::Tag tag, const std::vector<Gram> & grams);
+
+    // Get the tags of the entries that contain each of 'literals', sorted.
+    // Literals shorter than a trigram don't narrow the search, so at least
+    // one must be three bytes or longer.
+    void find(const std::vector<std::string> & literals,
+              std::vector<I_Deduper::Tag>    & tags) const;
+
+    // Drop the postings of the entries failing 'live', and duplicates, for
+    // the given trigram. Pruning a trigram at a time lets the caller
+    // interleave other work.
+    template <typename Live> void prune(Gram gram, Live live) {
+        auto iter = _postings.find(gram);
+
+        if (iter != _postings.end()) {
+            auto & tags = iter->second;
+            auto   size = tags.size();
+
+            std::sort(tags.begin(), tags.end());
+            tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+            tags.erase(std::remove_if(tags.begin(), tags.end(),
+                                      [&live](I_Deduper::Tag tag) { return !live(tag); }),
+                       tags.end());
+            _count -= size - tags.size();
+
+            if (tags.empty()) {
+                _postings.erase(iter);
+            }
+            else {
+                tags.shrink_to_fit();
+            }
+        }
+    }
+
+    void getGrams(std::vector<Gram> & grams) const;
+    size_t getCount() const { return _count; }
+};
+
+#endif // COMMON__TRIGRAM_INDEX__HXX
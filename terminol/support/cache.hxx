@@ -47,6 +47,7 @@ template <typename Key, typename T> class Cache : protected Uncopyable {
 
     struct Entry {
         Entry(const T & t_) : t(t_) {}
+        Entry(T && t_) : t(std::move(t_)) {}
         T     t;
         Link  link;
     };
@@ -232,10 +233,22 @@ public:
         return iterator(&entry.link);
     }
 
+    iterator insert(const Key & key, T && t) {
+        auto pair = _map.emplace(key, std::move(t));
+        ASSERT(pair.second, "Duplicate key.");
+
+        auto & entry = pair.first->second;
+        _sentinel.insert(entry.link);
+
+        return iterator(&entry.link);
+    }
+
     iterator erase(iterator iter) {
         auto & entry = linkToEntry(*iter._link);
         Link * next  = entry.link.next;
         entry.link.extract();
+        Key key = entryToKey(entry);    // Copy, the entry is about to be destroyed.
+        _map.erase(key);
         return iterator(next);
     }
 
@@ -253,6 +266,12 @@ public:
         }
     }
 
+    void clear() {
+        while (!empty()) {
+            erase(begin());
+        }
+    }
+
     T & at(const Key & key) {
         auto iter = find(key);
 
@@ -264,6 +283,10 @@ public:
         }
     }
 
+    size_t count(const Key & key) const {
+        return _map.count(key);
+    }
+
     bool empty() const {
         return _map.empty();
     }
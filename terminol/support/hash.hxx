@@ -4,7 +4,8 @@
 #ifndef SUPPORT__HASH__HXX
 #define SUPPORT__HASH__HXX
 
-#include <algorithm>
+#include <numeric>
+#include <cstdint>
 
 template <class T> struct SDBM {
     typedef T Type;
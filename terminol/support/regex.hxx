@@ -10,15 +10,30 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 
 #include <pcre.h>
 
 // Regex r("foo");
 // r.match("foo bar");
 
+// Patterns are JIT compiled where PCRE supports it. Plain literals, e.g.
+// "foo\.bar" or "(?i)foo", bypass PCRE and are found with memmem()/memchr().
+// The match data is reused between calls, so a Regex must not be used by more
+// than one thread at a time.
 class Regex : protected Uncopyable {
-    pcre    * _pcre;
-    const int _maxMatches;
+    static const int JIT_STACK_START = 32 * 1024;
+    static const int JIT_STACK_MAX   = 1024 * 1024;
+
+    pcre                   * _pcre;         // Null for literals.
+    pcre_extra             * _extra;        // Study data, may be null.
+    pcre_jit_stack         * _jitStack;
+    const int                _maxMatches;
+    mutable std::vector<int> _offsets;      // Match data, reused.
+    std::string              _literal;      // Lower case if caseless.
+    bool                     _caseless;
 public:
     struct Substr {
         Substr(int first_, int last_) : first(first_), last(last_) {}
@@ -34,8 +49,19 @@ public:
 
     explicit Regex(const std::string & pattern, int maxMatches = 10) throw (Error) :
         _pcre(nullptr),
-        _maxMatches(maxMatches)
+        _extra(nullptr),
+        _jitStack(nullptr),
+        _maxMatches(maxMatches),
+        _offsets(maxMatches * 3, 0),
+        _literal(),
+        _caseless(false)
     {
+        _literal = parseLiteral(pattern, _caseless);
+
+        if (!_literal.empty()) {
+            return;
+        }
+
         const char * err       = nullptr;
         int          errOffset = 0;
 
@@ -50,10 +76,119 @@ public:
                         "failed at offset " + stringify(errOffset) +
                         ", error: " + stringify(err));
         }
+
+        _extra = pcre_study(_pcre, PCRE_STUDY_JIT_COMPILE, &err);
+
+        if (err) {
+            pcre_free(_pcre);
+            throw Error("PCRE study of \"" + pattern + "\" failed, error: " + stringify(err));
+        }
+
+        if (_extra) {
+            // The default JIT stack (on the machine stack) is small.
+            _jitStack = pcre_jit_stack_alloc(JIT_STACK_START, JIT_STACK_MAX);
+            if (_jitStack) {
+                pcre_assign_jit_stack(_extra, nullptr, _jitStack);
+            }
+        }
     }
 
     ~Regex() {
-        pcre_free(_pcre);
+        if (_jitStack) { pcre_jit_stack_free(_jitStack); }
+        if (_extra)    { pcre_free_study(_extra); }
+        if (_pcre)     { pcre_free(_pcre); }
+    }
+
+    // Is the pattern matched without PCRE?
+    bool isLiteral() const { return !_literal.empty(); }
+
+    // Get runs of literal text that every match of 'pattern' must contain,
+    // e.g. "foo.*bar" yields "foo" and "bar". Only what is certain is
+    // returned: nothing inside groups or classes, and nothing at all for
+    // patterns with alternation, option settings or escapes with arguments.
+    static std::vector<std::string> requiredLiterals(const std::string & pattern) {
+        std::vector<std::string> literals;
+        std::string              run;
+        int                      depth = 0;
+
+        auto endRun = [&]() {
+            if (!run.empty()) {
+                literals.push_back(run);
+                run.clear();
+            }
+        };
+
+        // Remove the last (UTF-8) character, a quantifier makes it optional.
+        auto dropLast = [&]() {
+            while (!run.empty() && (run.back() & 0xC0) == 0x80) { run.pop_back(); }
+            if (!run.empty()) { run.pop_back(); }
+        };
+
+        for (size_t i = 0; i != pattern.size(); ++i) {
+            auto c = pattern[i];
+
+            if (pattern.compare(i, 2, "(?") == 0 || (c == '|' && depth == 0)) {
+                return std::vector<std::string>();
+            }
+            else if (c == '\\') {
+                if (++i == pattern.size()) {
+                    break;
+                }
+                else if (strchr("xcokgpPN0123456789", pattern[i])) {
+                    // The escape takes an argument, e.g. "\x41" or "\k<name>".
+                    return std::vector<std::string>();
+                }
+                else if (depth != 0) {
+                    // Groups may be optional.
+                }
+                else if (isalnum(static_cast<unsigned char>(pattern[i]))) {
+                    // A class, assertion or back-reference.
+                    endRun();
+                }
+                else {
+                    run.push_back(pattern[i]);
+                }
+            }
+            else if (c == '[') {
+                endRun();
+                // Skip the class. A ']' may come first, e.g. "[]a]" and "[^]a]".
+                if (i + 1 != pattern.size() && pattern[i + 1] == '^') { ++i; }
+                if (i + 1 != pattern.size() && pattern[i + 1] == ']') { ++i; }
+                while (++i < pattern.size() && pattern[i] != ']') {
+                    if (pattern[i] == '\\') { ++i; }
+                }
+                if (i >= pattern.size()) { break; }
+            }
+            else if (c == '{') {
+                dropLast();
+                endRun();
+                i = std::min(pattern.find('}', i), pattern.size() - 1);
+            }
+            else if (c == '(') {
+                endRun();
+                ++depth;
+            }
+            else if (c == ')') {
+                --depth;
+            }
+            else if (depth != 0) {
+                // Groups may be optional.
+            }
+            else if (c == '*' || c == '?') {
+                dropLast();
+                endRun();
+            }
+            else if (c == '+' || c == '.' || c == '^' || c == '$') {
+                endRun();
+            }
+            else {
+                run.push_back(c);
+            }
+        }
+
+        endRun();
+
+        return literals;
     }
 
     // First element is "whole match", subsequent are "captures" (things in parentheses).
@@ -96,6 +231,7 @@ public:
         return !common(text, size).empty();
     }
 
+    // Non-empty matches only, e.g. "a*" yields nothing for "bcd".
     std::vector<std::vector<Substr>> matchAllOffsets(const char * text, size_t size) const {
         std::vector<std::vector<Substr>> allOffsets;
 
@@ -107,6 +243,16 @@ public:
             if (offsets.empty()) {
                 break;
             }
+            else if (offsets.front().first == offsets.front().last) {
+                // Step over the next UTF-8 sequence and try again.
+                offset = offsets.front().last;
+
+                if (offset == size) {
+                    break;
+                }
+
+                do { ++offset; } while (offset != size && (text[offset] & 0xC0) == 0x80);
+            }
             else {
                 offset = offsets.front().last;
                 allOffsets.push_back(std::move(offsets));
@@ -121,20 +267,120 @@ public:
     }
 
 protected:
+    // Get the text of 'pattern' if it is plain text, optionally preceded by
+    // "(?i)", else return an empty string. ASCII only if caseless, since PCRE
+    // folds the case of other characters too.
+    static std::string parseLiteral(const std::string & pattern, bool & caseless) {
+        std::string literal;
+        size_t      i = 0;
+
+        caseless = pattern.compare(0, 4, "(?i)") == 0;
+        if (caseless) { i = 4; }
+
+        for (; i != pattern.size(); ++i) {
+            auto c = pattern[i];
+
+            if (c == '\\') {
+                if (++i == pattern.size() || isalnum(static_cast<unsigned char>(pattern[i]))) {
+                    return std::string();
+                }
+                literal.push_back(pattern[i]);
+            }
+            else if (c == '\0' || strchr("^$.[]|()?*+{", c)) {
+                return std::string();
+            }
+            else {
+                literal.push_back(c);
+            }
+        }
+
+        if (caseless) {
+            for (auto & c : literal) {
+                if (c & 0x80) { return std::string(); }
+                c = lower(c);
+            }
+        }
+
+        return literal;
+    }
+
+    static char lower(char c) {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    // Return the offset of the first occurrence of the literal at or beyond
+    // 'offset', or 'size' if there is none.
+    size_t findLiteral(const char * text, size_t size, size_t offset) const {
+        auto needle = _literal.data();
+        auto length = _literal.size();
+
+        if (offset > size || size - offset < length) {
+            return size;
+        }
+        else if (!_caseless) {
+            auto found = static_cast<const char *>(memmem(text + offset, size - offset,
+                                                          needle, length));
+            return found ? found - text : size;
+        }
+
+        // Find the candidates by scanning for either case of the first
+        // character, then compare the rest.
+        auto last  = size - length;     // The last candidate.
+        auto scan  = [&](char c, size_t from) -> size_t {
+            if (from > last) { return size; }
+            auto found = static_cast<const char *>(memchr(text + from, c, last + 1 - from));
+            return found ? found - text : size;
+        };
+
+        auto lowerC = needle[0];
+        auto upperC = lowerC >= 'a' && lowerC <= 'z' ? static_cast<char>(lowerC - 'a' + 'A') : lowerC;
+        auto l      = scan(lowerC, offset);
+        auto u      = upperC != lowerC ? scan(upperC, offset) : size;
+
+        for (;;) {
+            auto candidate = std::min(l, u);
+
+            if (candidate == size) {
+                return size;
+            }
+
+            size_t i = 1;
+            while (i != length && lower(text[candidate + i]) == needle[i]) { ++i; }
+
+            if (i == length) {
+                return candidate;
+            }
+            else if (candidate == l) {
+                l = scan(lowerC, candidate + 1);
+            }
+            else {
+                u = scan(upperC, candidate + 1);
+            }
+        }
+    }
+
     std::vector<Substr> common(const char * text, size_t size, size_t offset = 0) const {
-        // FIXME This will need reworking. We don't want to allocate offsets everytime
-        // this function is called. Also, if there is insufficient match room then we want
+        // FIXME If there is insufficient match room then we want
         // to try again with more match room.
         // XXX Or, perhaps we need a different code path for when we are just
         // testing for the existence a match and not interested in the results.
 
         // XXX may want PCRE_NO_UTF8_CHECK check in options.
 
-        std::vector<int>    offsets(_maxMatches * 3, 0);
         std::vector<Substr> substrs;
 
+        if (!_literal.empty()) {
+            auto first = findLiteral(text, size, offset);
+            if (first != size) {
+                substrs.emplace_back(first, first + _literal.size());
+            }
+            return substrs;
+        }
+
+        auto & offsets = _offsets;
+
         auto rval = pcre_exec(_pcre,
-                              nullptr,          // study
+                              _extra,           // study
                               text,             // subject
                               size,             // length of subject
                               offset,           // offset into subject
@@ -154,7 +400,6 @@ protected:
         }
         else if (rval == 0) {
             ERROR("Insufficient match room.");
-            offsets.resize(0);
             return substrs;
         }
         else {
@@ -112,7 +112,7 @@ public:
 
         if (!_timeoutRegs.empty()) {
             auto now  = Clock::now();
-            auto next = std::max(now, _timeoutRegs.front().time);
+            auto next = std::max(now, _timeoutRegs.back().time);
 
             auto duration = std::chrono::duration_cast<std::chrono::microseconds>(next - now);
 
@@ -274,7 +274,7 @@ public:
 
         if (!_timeoutRegs.empty()) {
             auto now  = Clock::now();
-            auto next = std::max(now, _timeoutRegs.front().time);
+            auto next = std::max(now, _timeoutRegs.back().time);
 
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(next - now);
             auto timeout  = duration.count();
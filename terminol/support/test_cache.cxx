@@ -59,6 +59,16 @@ int main() {
 
     cache.erase(cache.find(6));
     enforceKeys(cache, {42, 99});
+    ENFORCE(cache.size() == 2, "");
+    ENFORCE(cache.find(6) == cache.end(), "");
+
+    cache.insert(6, "feet under");
+    enforceKeys(cache, {42, 99, 6});
+
+    auto iter = cache.erase(cache.begin());
+    ENFORCE(iter->first == 99, "");
+    enforceKeys(cache, {99, 6});
+    ENFORCE(cache.size() == 2, "");
 
     return 0;
 }
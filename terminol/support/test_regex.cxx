@@ -3,6 +3,27 @@
 
 #include "terminol/support/regex.hxx"
 
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+size_t countMatches(const std::string & pattern, const std::string & text, bool literal) {
+    Regex regex(pattern);
+    ENFORCE(regex.isLiteral() == literal, pattern);
+
+    auto start   = std::chrono::steady_clock::now();
+    auto matches = regex.matchAllOffsets(text.data(), text.size());
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << pattern << ": " << matches.size() << " matches, "
+              << text.size() / seconds / (1024 * 1024) << " MB/s" << std::endl;
+
+    return matches.size();
+}
+
+} // namespace {anonymous}
+
 int main() try {
     Regex regex("(\\w+) and (\\w+)");
     auto m = regex.matchString("Some foods are chewy and crunchy.");
@@ -11,6 +32,50 @@ int main() try {
     ENFORCE(m[1] == "chewy", m[1]);
     ENFORCE(m[2] == "crunchy", m[2]);
 
+    Regex digits("\\d*");
+    std::string text = "a1b\xC3\xA9" "23";
+    auto all = digits.matchAllOffsets(text.data(), text.size());
+    ENFORCE(all.size() == 2, all.size());
+    ENFORCE(all[0][0].first == 1 && all[0][0].last == 2, "");
+    ENFORCE(all[1][0].first == 5 && all[1][0].last == 7, "");
+
+    typedef std::vector<std::string> Literals;
+    ENFORCE(Regex::requiredLiterals("foo.*bar") == Literals({"foo", "bar"}), "");
+    ENFORCE(Regex::requiredLiterals("colou?r\\.") == Literals({"colo", "r."}), "");
+    ENFORCE(Regex::requiredLiterals("ab{2}c[x]]d\\w+e") == Literals({"a", "c", "]d", "e"}), "");
+    ENFORCE(Regex::requiredLiterals("x(y|z)+w") == Literals({"x", "w"}), "");
+    ENFORCE(Regex::requiredLiterals("x|y").empty(), "");
+    ENFORCE(Regex::requiredLiterals("(?i)abc").empty(), "");
+    ENFORCE(Regex::requiredLiterals("\\x41BCD").empty(), "");
+    ENFORCE(Regex::requiredLiterals("\\cAbcd").empty(), "");
+    ENFORCE(Regex::requiredLiterals("\\012345").empty(), "");
+    ENFORCE(Regex::requiredLiterals("\\k<name>").empty(), "");
+    ENFORCE(Regex::requiredLiterals("\\pLfoo").empty(), "");
+
+    Regex dotted("a\\.b");
+    ENFORCE(dotted.isLiteral(), "");
+    ENFORCE(!dotted.matchTest("axb") && dotted.matchTest("xa.b"), "");
+    Regex caseless("(?i)Mi");
+    ENFORCE(caseless.isLiteral(), "");
+    auto ci = caseless.matchString("xxmmIMiM");
+    ENFORCE(ci.size() == 1 && ci[0] == "mI", "");
+    ENFORCE(!Regex("(?i)\xC3\xA9").isLiteral(), "");
+
+    // Benchmark the literal and PCRE paths over a few MB of text.
+    std::string haystack;
+    size_t      needles = 0, ciNeedles = 0;
+    for (int i = 0; haystack.size() < 8 * 1024 * 1024; ++i) {
+        haystack += "line " + stringify(i) + ": the quick brown fox jumps over the lazy dog";
+        if (i % 97 == 0)  { haystack += " needle";  ++needles; }
+        if (i % 101 == 0) { haystack += " NeEdLe"; ++ciNeedles; }
+        haystack += '\n';
+    }
+
+    ENFORCE(countMatches("needle", haystack, true) == needles, "");
+    ENFORCE(countMatches("needl[e]", haystack, false) == needles, "");
+    ENFORCE(countMatches("(?i)needle", haystack, true) == needles + ciNeedles, "");
+    ENFORCE(countMatches("(?i)needl[e]", haystack, false) == needles + ciNeedles, "");
+
     return 0;
 }
 catch (const Regex::Error & error) {
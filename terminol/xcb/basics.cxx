@@ -88,6 +88,7 @@ Basics::Basics() throw (Error) {
             _atomUtf8String = XCB_ATOM_STRING;
         }
         _atomTargets            = lookupAtom("TARGETS", true);
+        _atomIncr               = lookupAtom("INCR", true);
         _atomWmProtocols        = lookupAtom("WM_PROTOCOLS", false);
         _atomWmDeleteWindow     = lookupAtom("WM_DELETE_WINDOW", true);
         _atomXRootPixmapId      = lookupAtom("_XROOTPMAP_ID", true);
@@ -3,6 +3,38 @@
 
 #include "terminol/xcb/dispatcher.hxx"
 
+#include <algorithm>
+
+void Dispatcher::watch(xcb_window_t window, I_Observer * observer) {
+    ASSERT(_observers.find(window) == _observers.end(), "Watching our own window.");
+
+    auto & observers = _watchers[window];
+
+    if (observers.empty()) {
+        uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+        xcb_change_window_attributes(_connection, window, XCB_CW_EVENT_MASK, &mask);
+    }
+
+    observers.push_back(observer);
+}
+
+void Dispatcher::unwatch(xcb_window_t window, I_Observer * observer) {
+    auto iter = _watchers.find(window);
+    if (iter == _watchers.end()) { return; }        // Destroyed.
+
+    auto & observers = iter->second;
+    auto   oiter     = std::find(observers.begin(), observers.end(), observer);
+    ASSERT(oiter != observers.end(), "Not watching.");
+    observers.erase(oiter);
+
+    if (observers.empty()) {
+        _watchers.erase(iter);
+
+        uint32_t mask = XCB_EVENT_MASK_NO_EVENT;
+        xcb_change_window_attributes(_connection, window, XCB_CW_EVENT_MASK, &mask);
+    }
+}
+
 void Dispatcher::poll() throw (Error) {
     for (;;) {
         auto event = ::xcb_poll_for_event(_connection);
@@ -130,6 +162,14 @@ void Dispatcher::dispatch(uint8_t responseType, xcb_generic_event_t * event) {
             auto e = reinterpret_cast<xcb_destroy_notify_event_t *>(event);
             auto i = _observers.find(e->window);
             if (i != _observers.end()) { i->second->destroyNotify(e); }
+
+            auto w = _watchers.find(e->window);
+            if (w != _watchers.end()) {
+                // The window is no longer watched, whatever the watchers do.
+                auto observers = std::move(w->second);
+                _watchers.erase(w);
+                for (auto o : observers) { o->destroyNotify(e); }
+            }
             break;
         }
         case XCB_SELECTION_CLEAR: {
@@ -167,6 +207,12 @@ void Dispatcher::dispatch(uint8_t responseType, xcb_generic_event_t * event) {
             auto e = reinterpret_cast<xcb_property_notify_event_t *>(event);
             auto i = _observers.find(e->window);
             if (i != _observers.end()) { i->second->propertyNotify(e); }
+
+            auto w = _watchers.find(e->window);
+            if (w != _watchers.end()) {
+                auto observers = w->second;     // They may unwatch.
+                for (auto o : observers) { o->propertyNotify(e); }
+            }
             break;
         }
         default:
@@ -9,6 +9,7 @@
 #include "terminol/support/conv.hxx"
 
 #include <unordered_map>
+#include <vector>
 
 #include <xcb/xcb_event.h>
 #include <xcb/xcb_aux.h>
@@ -48,6 +49,13 @@ public:
     virtual void add(xcb_window_t window, I_Observer * observer) = 0;
     virtual void remove(xcb_window_t window) = 0;
 
+    // Watch a window of another client for property changes and for its
+    // destruction. Any number of observers may watch the same window, each
+    // as many times as it likes, and the window is watched until they have
+    // all unwatched it or it is destroyed.
+    virtual void watch(xcb_window_t window, I_Observer * observer) = 0;
+    virtual void unwatch(xcb_window_t window, I_Observer * observer) = 0;
+
 protected:
   I_Dispatcher() {}
   ~I_Dispatcher() {}
@@ -88,6 +96,9 @@ public:
         _observers.erase(window);
     }
 
+    void watch(xcb_window_t window, I_Observer * observer) override;
+    void unwatch(xcb_window_t window, I_Observer * observer) override;
+
     // This method is public so that X events can be processed in the
     // absence of the file descriptor becoming readable. Why the descriptor
     // doesn't become readable is a mystery to me.
@@ -105,10 +116,12 @@ protected:
 
 private:
     typedef std::unordered_map<xcb_window_t, I_Observer *> Observers;
+    typedef std::unordered_map<xcb_window_t, std::vector<I_Observer *>> Watchers;
 
     I_Selector       & _selector;
     xcb_connection_t * _connection;
     Observers          _observers;
+    Watchers           _watchers;   // Once per watch() call.
 };
 
 
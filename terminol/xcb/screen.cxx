@@ -9,15 +9,25 @@
 #include <xcb/xcb_icccm.h>
 #include <pango/pangocairo.h>
 
+#include <algorithm>
 #include <limits>
 
 #include <unistd.h>
 
+namespace {
+
+// Bytes of selection sent per property, well within the maximum request
+// size. Larger selections are transferred with INCR.
+const size_t SELECTION_CHUNK = 64 * 1024;
+
+} // namespace {anonymous}
+
 Screen::Screen(I_Observer         & observer,
                const Config       & config,
                I_Selector         & selector,
                I_Deduper          & deduper,
                AsyncDestroyer     & destroyer,
+               Governor           & governor,
                I_Dispatcher       & dispatcher,
                Basics             & basics,
                const ColorSet     & colorSet,
@@ -46,6 +56,9 @@ Screen::Screen(I_Observer         & observer,
     _icon(_config.icon),
     _primarySelection(),
     _clipboardSelection(),
+    _transfers(),
+    _receiving(false),
+    _received(),
     _pressed(false),
     _pressCount(0),
     _lastPressTime(0),
@@ -123,7 +136,7 @@ Screen::Screen(I_Observer         & observer,
     // Create the TTY and terminal.
 
     try {
-        _terminal = new Terminal(*this, _config, selector, deduper, destroyer,
+        _terminal = new Terminal(*this, _config, selector, deduper, destroyer, governor,
                                  rows, cols, stringify(getWindow()), command);
         _open     = true;
     }
@@ -170,6 +183,12 @@ Screen::~Screen() {
 
     xcb_void_cookie_t cookie;
 
+    // Abandon any selection transfers.
+
+    while (!_transfers.empty()) {
+        endTransfer(_transfers.begin());
+    }
+
     // Unwind constructor.
 
     delete _terminal;
@@ -452,7 +471,16 @@ void Screen::leaveNotify(xcb_leave_notify_event_t * event) noexcept {
 }
 
 void Screen::destroyNotify(xcb_destroy_notify_event_t * event) noexcept {
-    ASSERT(event->window == getWindow(), "Unexpected window.");
+    if (event->window != getWindow()) {
+        // A requestor went away before its transfers finished.
+        auto iter = _transfers.lower_bound(std::make_pair(event->window, xcb_atom_t(0)));
+
+        while (iter != _transfers.end() && iter->first.first == event->window) {
+            endTransfer(iter++);
+        }
+
+        return;
+    }
 
     _terminal->killReap();
     _open      = false;
@@ -467,33 +495,16 @@ void Screen::selectionNotify(xcb_selection_notify_event_t * UNUSED(event)) noexc
     if (!_open) { return; }
 
     std::vector<uint8_t> content;
-    uint32_t             offset = 0;        // 32-bit quantities
-
-    for (;;) {
-        auto cookie = xcb_get_property(_basics.connection(),
-                                       false,     // delete
-                                       getWindow(),
-                                       XCB_ATOM_PRIMARY,
-                                       XCB_GET_PROPERTY_TYPE_ANY,
-                                       offset,
-                                       8192 / 4);
-
-        auto reply = xcb_get_property_reply(_basics.connection(), cookie, nullptr);
-        if (!reply) { break; }
-
-        auto guard  = scopeGuard([reply] { std::free(reply); });
-        auto value  = static_cast<uint8_t *>(xcb_get_property_value(reply));
-        auto length = xcb_get_property_value_length(reply);
-        if (length == 0) { break; }
 
-        auto oldSize = content.size();
-        content.resize(oldSize + length);
-        std::copy(value, value + length, content.begin() + oldSize);
-
-        offset += (length + 3) / 4;
+    if (readSelection(false, content) == _basics.atomIncr()) {
+        // The owner sends the selection in chunks, each once we have
+        // deleted the last, see propertyNotify().
+        _receiving = true;
+        _received.clear();
+        xcb_delete_property(_basics.connection(), getWindow(), XCB_ATOM_PRIMARY);
+        xcb_flush(_basics.connection());
     }
-
-    if (!content.empty()) {
+    else if (!content.empty()) {
         _terminal->paste(&content.front(), content.size());
     }
 }
@@ -523,7 +534,7 @@ void Screen::selectionRequest(xcb_selection_request_event_t * event) noexcept {
         response.property = event->property;
     }
     else if (event->target == _basics.atomUtf8String()) {
-        std::string text;
+        Text text;
 
         if (event->selection == _basics.atomPrimary()) {
             text = _primarySelection;
@@ -535,15 +546,42 @@ void Screen::selectionRequest(xcb_selection_request_event_t * event) noexcept {
             ERROR("Unexpected selection.");
         }
 
-        auto cookie = xcb_change_property_checked(_basics.connection(),
-                                                  XCB_PROP_MODE_REPLACE,
-                                                  event->requestor,
-                                                  event->property,
-                                                  event->target,
-                                                  8,
-                                                  text.length(),
-                                                  text.data());
-        xcb_request_failed(_basics.connection(), cookie, "Failed to change property.");
+        auto screen = _observer.screenFind(event->requestor);
+
+        if (screen) {
+            // The requestor is one of our windows, perhaps this one. Paste
+            // the text into it directly, rather than through a property it
+            // would read all at once. There is nothing for it to be notified
+            // of.
+            if (text) {
+                screen->paste(text);
+            }
+
+            return;
+        }
+
+        std::string chunk;
+
+        if (text) {
+            auto cursor = text->begin();
+            text->read(cursor, chunk, SELECTION_CHUNK + 1);
+        }
+
+        if (chunk.size() <= SELECTION_CHUNK) {
+            auto cookie = xcb_change_property_checked(_basics.connection(),
+                                                      XCB_PROP_MODE_REPLACE,
+                                                      event->requestor,
+                                                      event->property,
+                                                      event->target,
+                                                      8,
+                                                      chunk.length(),
+                                                      chunk.data());
+            xcb_request_failed(_basics.connection(), cookie, "Failed to change property.");
+        }
+        else {
+            beginTransfer(event, text);
+        }
+
         response.property = event->property;
     }
 
@@ -557,6 +595,62 @@ void Screen::selectionRequest(xcb_selection_request_event_t * event) noexcept {
     xcb_flush(_basics.connection());        // Required?
 }
 
+void Screen::propertyNotify(xcb_property_notify_event_t * event) noexcept {
+    if (event->window == getWindow()) {
+        if (!_receiving || event->state != XCB_PROPERTY_NEW_VALUE ||
+            event->atom != XCB_ATOM_PRIMARY)
+        {
+            return;
+        }
+
+        // Taking the chunk asks the owner for the next. The final chunk is
+        // empty.
+        auto oldSize = _received.size();
+
+        if (readSelection(true, _received) == XCB_ATOM_NONE ||
+            _received.size() == oldSize)
+        {
+            _receiving = false;
+
+            if (_open && !_received.empty()) {
+                _terminal->paste(&_received.front(), _received.size());
+            }
+
+            std::vector<uint8_t>().swap(_received);
+        }
+
+        xcb_flush(_basics.connection());
+        return;
+    }
+
+    if (event->state != XCB_PROPERTY_DELETE) { return; }
+
+    auto iter = _transfers.find(std::make_pair(event->window, event->atom));
+    if (iter == _transfers.end()) { return; }
+
+    // The requestor has taken the last chunk, send the next. The final
+    // chunk is empty.
+    auto &      transfer = iter->second;
+    std::string chunk;
+    auto        more     = transfer.text->read(transfer.cursor, chunk, SELECTION_CHUNK);
+
+    auto cookie = xcb_change_property_checked(_basics.connection(),
+                                              XCB_PROP_MODE_REPLACE,
+                                              event->window,
+                                              event->atom,
+                                              transfer.target,
+                                              8,
+                                              chunk.length(),
+                                              chunk.data());
+    xcb_request_failed(_basics.connection(), cookie, "Failed to change property.");
+
+    if (!more) {
+        endTransfer(iter);
+    }
+
+    xcb_flush(_basics.connection());
+}
+
 void Screen::clientMessage(xcb_client_message_event_t * event) noexcept {
     if (event->type == _basics.atomWmProtocols()) {
         if (event->data.data32[0] == _basics.atomWmDeleteWindow()) {
@@ -590,6 +684,27 @@ void Screen::clearSelection() {
     _terminal->clearSelection();
 }
 
+void Screen::paste(const std::shared_ptr<SelectedText> & text) {
+    if (_open) {
+        _terminal->paste(text);
+    }
+}
+
+uint32_t Screen::getHistory(uint32_t                         since,
+                            uint32_t                       & lost,
+                            std::vector<I_Deduper::Tag>    & tags,
+                            std::vector<std::vector<Cell>> & paras) const {
+    return _terminal->getHistory(since, lost, tags, paras);
+}
+
+void Screen::restoreHistory(const std::vector<I_Deduper::Tag> & tags) {
+    _terminal->restoreHistory(tags);
+}
+
+void Screen::exportHistory(const std::string & path, bool styles) {
+    _terminal->exportHistory(path, styles);
+}
+
 void Screen::deferral() {
     ASSERT(_deferred, "");
     _deferred = false;
@@ -1085,6 +1200,79 @@ void Screen::handleDelete() {
     }
 }
 
+void Screen::beginTransfer(xcb_selection_request_event_t * event, const Text & text) {
+    auto requestor = event->requestor;
+    auto key       = std::make_pair(requestor, event->property);
+    auto iter      = _transfers.lower_bound(std::make_pair(requestor, xcb_atom_t(0)));
+
+    if (iter == _transfers.end() || iter->first.first != requestor) {
+        // Watch for the requestor deleting the property, or going away.
+        // Other screens may be watching it too.
+        getDispatcher().watch(requestor, this);
+    }
+
+    // A new request for the same property replaces the old.
+    _transfers.erase(key);
+    _transfers.insert(std::make_pair(key, Transfer(text, event->target)));
+
+    // The size is a lower bound.
+    auto size   = static_cast<uint32_t>(std::min<size_t>(text->getCells(),
+                                                         std::numeric_limits<uint32_t>::max()));
+    auto cookie = xcb_change_property_checked(_basics.connection(),
+                                              XCB_PROP_MODE_REPLACE,
+                                              requestor,
+                                              event->property,
+                                              _basics.atomIncr(),
+                                              32,
+                                              1,
+                                              &size);
+    xcb_request_failed(_basics.connection(), cookie, "Failed to change property.");
+}
+
+void Screen::endTransfer(Transfers::iterator iter) {
+    auto requestor = iter->first.first;
+    _transfers.erase(iter);
+
+    iter = _transfers.lower_bound(std::make_pair(requestor, xcb_atom_t(0)));
+
+    if (iter == _transfers.end() || iter->first.first != requestor) {
+        getDispatcher().unwatch(requestor, this);
+    }
+}
+
+xcb_atom_t Screen::readSelection(bool remove, std::vector<uint8_t> & content) {
+    uint32_t offset = 0;        // 32-bit quantities
+
+    for (;;) {
+        auto cookie = xcb_get_property(_basics.connection(),
+                                       remove,    // delete, once all is read
+                                       getWindow(),
+                                       XCB_ATOM_PRIMARY,
+                                       XCB_GET_PROPERTY_TYPE_ANY,
+                                       offset,
+                                       8192 / 4);
+
+        auto reply = xcb_get_property_reply(_basics.connection(), cookie, nullptr);
+        if (!reply) { return XCB_ATOM_NONE; }
+
+        auto guard  = scopeGuard([reply] { std::free(reply); });
+
+        // The value of an INCR property is only a lower bound on the size.
+        if (reply->type == _basics.atomIncr()) { return reply->type; }
+
+        auto value  = static_cast<uint8_t *>(xcb_get_property_value(reply));
+        auto length = xcb_get_property_value_length(reply);
+
+        auto oldSize = content.size();
+        content.resize(oldSize + length);
+        std::copy(value, value + length, content.begin() + oldSize);
+
+        offset += (length + 3) / 4;
+
+        if (reply->bytes_after == 0) { return reply->type; }
+    }
+}
+
 void Screen::cursorVisibility(bool visible) {
     ASSERT(_config.autoHideCursor, "");
 
@@ -1108,7 +1296,7 @@ const std::string & Screen::terminalGetDisplayName() const {
     return _basics.displayName();
 }
 
-void Screen::terminalCopy(const std::string & text, Terminal::Selection selection) {
+void Screen::terminalCopy(std::shared_ptr<SelectedText> text, Terminal::Selection selection) {
     _observer.screenSelected(this);
 
     xcb_atom_t atom = XCB_ATOM_NONE;
@@ -1140,6 +1328,10 @@ void Screen::terminalPaste(Terminal::Selection selection) {
             break;
     }
 
+    // Abandon any INCR selection still arriving, its chunks would mix in.
+    _receiving = false;
+    std::vector<uint8_t>().swap(_received);
+
     xcb_convert_selection(_basics.connection(),
                           getWindow(),
                           atom,
@@ -1389,6 +1581,44 @@ void Screen::terminalDrawCursor(Pos             pos,
     } cairo_restore(_cr);
 }
 
+bool Screen::terminalMoveRows(int16_t begin,
+                              int16_t end,
+                              int16_t rows) {
+    ASSERT(_cr, "");
+    ASSERT(begin < end, "");
+
+    if (_config.x11PseudoTransparency) {
+        // The root pixmap doesn't move with the rows.
+        return false;
+    }
+
+    int16_t src = rows > 0 ? begin + rows : begin;
+    int16_t dst = rows > 0 ? begin : begin - rows;
+    int16_t num = end - begin - (rows > 0 ? rows : -rows);
+
+    int x, ySrc, yDst;
+    pos2XY(Pos(src, 0), x, ySrc);
+    pos2XY(Pos(dst, 0), x, yDst);
+
+    auto w = _terminal->getCols() * _fontSet->getWidth();
+    auto h = num * _fontSet->getHeight();
+
+    // Cairo must not be holding pending drawing or stale pixels.
+    cairo_surface_flush(_surface);
+
+    xcb_copy_area(_basics.connection(),
+                  _pixmap,
+                  _pixmap,
+                  _gc,
+                  x, ySrc,    // src
+                  x, yDst,    // dst
+                  w, h);
+
+    cairo_surface_mark_dirty(_surface);
+
+    return true;
+}
+
 void Screen::terminalDrawScrollbar(size_t  totalRows,
                                    size_t  historyOffset,
                                    int16_t visibleRows) {
@@ -15,6 +15,9 @@
 #include "terminol/support/selector.hxx"
 #include "terminol/support/pattern.hxx"
 
+#include <map>
+#include <memory>
+
 #include <xcb/xcb.h>
 #include <xcb/xcb_keysyms.h>
 #include <cairo-xcb.h>
@@ -31,6 +34,8 @@ public:
         virtual void screenDefer(Screen * screen) = 0;
         virtual void screenSelected(Screen * screen) = 0;
         virtual void screenReaped(Screen * screen, int status) = 0;
+        // Return our screen with this window, or null.
+        virtual Screen * screenFind(xcb_window_t window) = 0;
 
     protected:
         I_Observer() {}
@@ -69,8 +74,26 @@ private:
     std::string       _title;
     std::string       _icon;
 
-    std::string       _primarySelection;
-    std::string       _clipboardSelection;
+    typedef std::shared_ptr<SelectedText> Text;
+
+    // An INCR transfer of a selection to another client, a chunk each time
+    // it deletes the property.
+    struct Transfer {
+        Text                 text;
+        SelectedText::Cursor cursor;
+        xcb_atom_t           target;
+
+        Transfer(const Text & text_, xcb_atom_t target_) :
+            text(text_), cursor(text_->begin()), target(target_) {}
+    };
+
+    typedef std::map<std::pair<xcb_window_t, xcb_atom_t>, Transfer> Transfers;
+
+    Text              _primarySelection;
+    Text              _clipboardSelection;
+    Transfers         _transfers;           // By requestor and property.
+    bool              _receiving;           // Is an INCR selection arriving?
+    std::vector<uint8_t> _received;         // The chunks so far.
 
     bool              _pressed;         // Is there an active button press?
     int               _pressCount;      // single, double, triple-click, etc
@@ -95,6 +118,7 @@ public:
            I_Selector         & selector,
            I_Deduper          & deduper,
            AsyncDestroyer     & destroyer,
+           Governor           & governor,
            I_Dispatcher       & dispatcher,
            Basics             & basics,
            const ColorSet     & colorSet,
@@ -111,8 +135,17 @@ public:
     void tryReap();
     void killReap();
     void clearSelection();
+    // Paste a selection of one of our screens, a piece at a time.
+    void paste(const std::shared_ptr<SelectedText> & text);
     void deferral();
 
+    uint32_t getHistory(uint32_t                         since,
+                        uint32_t                       & lost,
+                        std::vector<I_Deduper::Tag>    & tags,
+                        std::vector<std::vector<Cell>> & paras) const;
+    void     restoreHistory(const std::vector<I_Deduper::Tag> & tags);
+    void     exportHistory(const std::string & path, bool styles);
+
 protected:
     void icccmConfigure();
 
@@ -139,10 +172,18 @@ protected:
 
     void cursorVisibility(bool visible);
 
+    // Answer a request for more text than fits in one property with INCR.
+    void beginTransfer(xcb_selection_request_event_t * event, const Text & text);
+    // Stop watching the requestor once it has no more transfers.
+    void endTransfer(Transfers::iterator iter);
+    // Append the selection property on our window to 'content', deleting
+    // it if 'remove'. Return its type, or XCB_ATOM_NONE if unreadable.
+    xcb_atom_t readSelection(bool remove, std::vector<uint8_t> & content);
+
     // Terminal::I_Observer implementation:
 
     const std::string & terminalGetDisplayName() const override;
-    void terminalCopy(const std::string & text, Terminal::Selection selection) override;
+    void terminalCopy(std::shared_ptr<SelectedText> text, Terminal::Selection selection) override;
     void terminalPaste(Terminal::Selection selection) override;
     void terminalResizeLocalFont(int delta) override;
     void terminalResizeGlobalFont(int delta) override;
@@ -169,6 +210,9 @@ protected:
                             size_t          size,
                             bool            wrapNext,
                             bool            focused) override;
+    bool terminalMoveRows(int16_t begin,
+                          int16_t end,
+                          int16_t rows) override;
     void terminalDrawScrollbar(size_t  totalRows,
                                size_t  historyOffset,
                                int16_t visibleRows) override;
@@ -200,6 +244,7 @@ protected:
     void selectionNotify(xcb_selection_notify_event_t * event) noexcept override;
     void selectionRequest(xcb_selection_request_event_t * event) noexcept override;
     void clientMessage(xcb_client_message_event_t * event) noexcept override;
+    void propertyNotify(xcb_property_notify_event_t * event) noexcept override;
 
 private:
     DColor getColor(const UColor & ucolor) const {
@@ -8,6 +8,7 @@
 #include "terminol/xcb/common.hxx"
 #include "terminol/xcb/dispatcher.hxx"
 #include "terminol/common/simple_deduper.hxx"
+#include "terminol/common/governor.hxx"
 #include "terminol/common/config.hxx"
 #include "terminol/common/parser.hxx"
 #include "terminol/common/key_map.hxx"
@@ -36,6 +37,7 @@ class EventLoop :
     Pipe               _pipe;
     SimpleDeduper      _deduper;
     AsyncDestroyer     _destroyer;      // Must be declared after anything indirectly used by it.
+    Governor           _governor;
     Basics             _basics;
     ColorSet           _colorSet;
     FontManager        _fontManager;
@@ -57,8 +59,9 @@ public:
         _config(config),
         _selector(),
         _pipe(),
-        _deduper(),
+        _deduper(config.historyMemory, config.historySpillDir, config.historyIndex),
         _destroyer(),
+        _governor(config, _deduper),
         _basics(),
         _colorSet(config, _basics),
         _fontManager(config, _basics),
@@ -68,6 +71,7 @@ public:
                 _selector,
                 _deduper,
                 _destroyer,
+                _governor,
                 _dispatcher,
                 _basics,
                 _colorSet,
@@ -120,6 +124,8 @@ protected:
 
             if (_exited)   { break; }
             if (_deferral) { _screen.deferral(); _deferral = false; }
+
+            _governor.enforce();
         }
 
         _dispatcher.remove(_basics.screen()->root);
@@ -165,6 +171,10 @@ protected:
         _exited = true;
     }
 
+    Screen * screenFind(xcb_window_t window) override {
+        return window == _screen.getWindowId() ? &_screen : nullptr;
+    }
+
     // I_Dispatcher::I_Observer implementation:
 
     void propertyNotify(xcb_property_notify_event_t * event) noexcept override {
@@ -7,6 +7,11 @@
 #include "terminol/support/debug.hxx"
 #include "terminol/support/cmdline.hxx"
 
+#include <memory>
+
+#include <climits>
+#include <unistd.h>
+
 namespace {
 
 std::string makeHelp(const std::string & progName) {
@@ -18,6 +23,9 @@ std::string makeHelp(const std::string & progName) {
         << "  --help" << std::endl
         << "  --socket=SOCKET" << std::endl
         << "  --shutdown" << std::endl
+        << "  --export=FILE" << std::endl
+        << "  --window=WINDOWID (default: $WINDOWID)" << std::endl
+        << "  --styles" << std::endl
         ;
     return ost.str();
 }
@@ -34,11 +42,27 @@ int main(int argc, char * argv[]) {
         FATAL(error.message);
     }
 
-    bool shutdown = false;
+    bool        shutdown = false;
+    std::string exportPath;
+    uint32_t    window   = 0;
+    bool        styles   = false;
+
+    auto windowId = ::getenv("WINDOWID");
+    if (windowId) {
+        try {
+            window = unstringify<uint32_t>(windowId);
+        }
+        catch (const ParseError &) {
+            // Leave it to --window.
+        }
+    }
 
     CmdLine cmdLine(makeHelp(argv[0]), VERSION);
     cmdLine.add(new StringHandler(config.socketPath), '\0', "socket");
     cmdLine.add(new BoolHandler(shutdown), '\0', "shutdown");
+    cmdLine.add(new StringHandler(exportPath), '\0', "export");
+    cmdLine.add(new IStreamHandler<uint32_t>(window), '\0', "window");
+    cmdLine.add(new BoolHandler(styles), '\0', "styles");
 
     // Command line
 
@@ -49,14 +73,30 @@ int main(int argc, char * argv[]) {
         FATAL(error.message);
     }
 
+    if (!exportPath.empty()) {
+        if (window == 0) {
+            FATAL("No window to export, use --window.");
+        }
+
+        // The server has its own working directory.
+        if (exportPath.front() != '/') {
+            char cwd[PATH_MAX];
+            ENFORCE_SYS(::getcwd(cwd, sizeof cwd), "");
+            exportPath = std::string(cwd) + "/" + exportPath;
+        }
+    }
+
     Selector selector;
 
     try {
-        Client client(selector, config, shutdown);
+        std::unique_ptr<Client> client(
+            exportPath.empty() ?
+            new Client(selector, config, shutdown) :
+            new Client(selector, config, window, exportPath, styles));
 
         do {
             selector.animate();
-        } while (!client.isFinished());
+        } while (!client->isFinished());
     }
     catch (const Client::Error & error) {
         FATAL(error.message);
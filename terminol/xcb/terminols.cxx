@@ -8,6 +8,8 @@
 #include "terminol/xcb/common.hxx"
 #include "terminol/xcb/dispatcher.hxx"
 #include "terminol/common/simple_deduper.hxx"
+#include "terminol/common/governor.hxx"
+#include "terminol/common/snapshot.hxx"
 #include "terminol/common/config.hxx"
 #include "terminol/common/parser.hxx"
 #include "terminol/common/key_map.hxx"
@@ -21,6 +23,7 @@
 
 #include <set>
 #include <map>
+#include <deque>
 #include <memory>
 
 #include <xcb/xcb.h>
@@ -30,8 +33,20 @@
 #include <unistd.h>
 #include <sys/select.h>
 
+namespace {
+
+// Milliseconds between snapshots of the windows' history.
+const int CHECKPOINT_INTERVAL = 60 * 1000;
+
+// Snapshot ids of the histories awaiting windows, with the bit that X
+// resource ids (the ids of the windows) never have.
+const uint32_t RESTORED_ID = 0x80000000;
+
+} // namespace {anonymous}
+
 class EventLoop :
     protected I_Selector::I_ReadHandler,
+    protected I_Selector::I_TimeoutHandler,
     protected Screen::I_Observer,
     protected I_Dispatcher::I_Observer,
     protected I_Creator,
@@ -41,8 +56,12 @@ class EventLoop :
     Tty::Command                   _command;
     Selector                       _selector;
     Pipe                           _pipe;
+    std::unique_ptr<SnapshotReader> _snapshotReader;    // Must outlive the deduper.
     SimpleDeduper                  _deduper;
     AsyncDestroyer                 _destroyer;      // Must be declared after anything indirectly used by it.
+    Governor                       _governor;       // Shared by all of the screens.
+    std::unique_ptr<SnapshotWriter> _snapshotWriter;
+    std::deque<std::vector<I_Deduper::Tag>> _restored;  // Histories awaiting windows.
     Basics                         _basics;
     Server                         _server;
     ColorSet                       _colorSet;
@@ -68,8 +87,12 @@ public:
         _command(command),
         _selector(),
         _pipe(),
-        _deduper(),
+        _snapshotReader(openSnapshot(config.historySnapshot)),
+        _deduper(config.historyMemory, config.historySpillDir, config.historyIndex),
         _destroyer(),
+        _governor(config, _deduper),
+        _snapshotWriter(),
+        _restored(),
         _basics(),
         _server(*this, _selector, config),
         _colorSet(config, _basics),
@@ -89,6 +112,18 @@ public:
             }
         }
 
+        if (!_config.historySnapshot.empty()) {
+            std::vector<I_Deduper::Tag> written;
+
+            if (_snapshotReader) {
+                _snapshotReader->restore(_deduper, _restored, written);
+            }
+
+            // Created after daemonising, which only keeps the calling thread.
+            _snapshotWriter.reset(new SnapshotWriter(_config.historySnapshot, _deduper, written));
+            _selector.addTimeoutable(this, CHECKPOINT_INTERVAL);
+        }
+
         if (_config.x11PseudoTransparency) {
             uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
             xcb_change_window_attributes(_basics.connection(),
@@ -105,6 +140,47 @@ public:
     }
 
 protected:
+    static SnapshotReader * openSnapshot(const std::string & path) {
+        if (!path.empty() && ::access(path.c_str(), F_OK) == 0) {
+            try {
+                return new SnapshotReader(path);
+            }
+            catch (const SnapshotReader::Error & error) {
+                PRINT("Failed to restore history: " << error.message);
+            }
+        }
+
+        return nullptr;
+    }
+
+    void checkpoint() {
+        std::vector<SnapshotWriter::Window> windows;
+
+        // Only the history added since the previous checkpoint is fetched.
+        for (auto & pair : _screens) {
+            windows.emplace_back();
+            auto & window = windows.back();
+            window.id = pair.first;
+            pair.second->getHistory(_snapshotWriter->getNext(window.id), window.lost,
+                                    window.tags, window.paras);
+        }
+
+        // Keep the histories that are yet to be given to windows. They are
+        // taken from the front, so their ids count from the back.
+        for (size_t i = 0; i != _restored.size(); ++i) {
+            windows.emplace_back();
+            auto & window = windows.back();
+            window.id   = RESTORED_ID + static_cast<uint32_t>(_restored.size() - 1 - i);
+            window.lost = 0;
+
+            if (_snapshotWriter->getNext(window.id) == 0) {
+                window.tags = _restored[i];
+            }
+        }
+
+        _snapshotWriter->checkpoint(std::move(windows));
+    }
+
     static void staticSignalHandler(int sigNum) {
         ASSERT(_singleton, "");
         _singleton->signalHandler(sigNum);
@@ -136,6 +212,12 @@ protected:
 
                     auto iter2 = _screens.find(screen->getWindowId());
                     ASSERT(iter2 != _screens.end(), "");
+
+                    if (_snapshotWriter) {
+                        // The window's id may be reused before the next checkpoint.
+                        _snapshotWriter->remove(iter2->first);
+                    }
+
                     _screens.erase(iter2);
                 }
                 _exits.clear();
@@ -144,6 +226,12 @@ protected:
             // Perform the deferrals.
             for (auto screen : _deferrals) { screen->deferral(); }
             _deferrals.clear();
+
+            _governor.enforce();
+        }
+
+        if (_snapshotWriter) {
+            _selector.removeTimeoutable(this);
         }
 
         _dispatcher.remove(_basics.screen()->root);
@@ -174,6 +262,13 @@ protected:
         death();
     }
 
+    // I_Selector::I_TimeoutHandler implementation:
+
+    void handleTimeout() override {
+        checkpoint();
+        _selector.addTimeoutable(this, CHECKPOINT_INTERVAL);
+    }
+
     // Screen::I_Observer implementation:
 
     void screenSync() override {
@@ -198,6 +293,11 @@ protected:
         _exits.push_back(screen);
     }
 
+    Screen * screenFind(xcb_window_t window) override {
+        auto iter = _screens.find(window);
+        return iter != _screens.end() ? iter->second.get() : nullptr;
+    }
+
     // I_Dispatcher::I_Observer implementation:
 
     void propertyNotify(xcb_property_notify_event_t * event) noexcept override {
@@ -219,9 +319,15 @@ protected:
     void create() override {
         try {
             std::unique_ptr<Screen> screen(
-                new Screen(*this, _config, _selector, _deduper, _destroyer, _dispatcher,
-                           _basics, _colorSet, _fontManager, _command));
+                new Screen(*this, _config, _selector, _deduper, _destroyer, _governor,
+                           _dispatcher, _basics, _colorSet, _fontManager, _command));
             auto id = screen->getWindowId();
+
+            if (!_restored.empty()) {
+                screen->restoreHistory(_restored.front());
+                _restored.pop_front();
+            }
+
             _screens.insert(std::make_pair(id, std::move(screen)));
         }
         catch (const Screen::Error & error) {
@@ -229,7 +335,23 @@ protected:
         }
     }
 
+    void exportHistory(uint32_t window, const std::string & path, bool styles) override {
+        auto iter = _screens.find(window);
+
+        if (iter != _screens.end()) {
+            iter->second->exportHistory(path, styles);
+        }
+        else {
+            PRINT("No such window: " << window);
+        }
+    }
+
     void shutdown() override {
+        // Save the history before the windows go.
+        if (_snapshotWriter) {
+            checkpoint();
+        }
+
         for (auto & pair : _screens) {
             pair.second->killReap();
         }
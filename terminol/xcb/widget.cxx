@@ -35,6 +35,7 @@ Widget::Widget(I_Dispatcher & dispatcher,
         XCB_EVENT_MASK_POINTER_MOTION_HINT | XCB_EVENT_MASK_POINTER_MOTION |
         XCB_EVENT_MASK_EXPOSURE |
         XCB_EVENT_MASK_STRUCTURE_NOTIFY |
+        XCB_EVENT_MASK_PROPERTY_CHANGE |    // For INCR selections.
         XCB_EVENT_MASK_FOCUS_CHANGE,
         // XCB_CW_CURSOR
         _basics.normalCursor()